@@ -78,6 +78,7 @@ function buildKalmanFilter() {
       -s ASSERTIONS=1 \
       -s "EXPORT_NAME='createKalmanFilterModule'" \
       -s USE_ES6_IMPORT_META=0 \
+      -msimd128 \
       -O3`;
     
     // コンパイル実行
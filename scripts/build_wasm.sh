@@ -29,11 +29,11 @@ build_kalman_filter() {
   echo "Building Kalman filter WASM module..."
   
   # Compile the Kalman filter
-  emcc "$WASM_SRC_DIR/kalman.cpp" "$WASM_SRC_DIR/kalman_demo.cpp" \
-    -O3 -s WASM=1 \
+  emcc "$WASM_SRC_DIR/kalman.cpp" "$WASM_SRC_DIR/kalman_smoother.cpp" "$WASM_SRC_DIR/kalman_demo.cpp" \
+    -O3 -msimd128 -s WASM=1 \
     -s MODULARIZE=1 -s EXPORT_NAME="createKalmanModule" \
     -s ALLOW_MEMORY_GROWTH=1 \
-    -s EXPORTED_FUNCTIONS="['_kf_create','_kf_update','_kf_destroy','_generate_noisy_sine','_demo_kalman_filter','_free_data','_malloc','_free']" \
+    -s EXPORTED_FUNCTIONS="['_kf_create','_kf_create_f32','_kf_create_steady','_kf_create_shared','_kf_create_motion','_kf_create_model','_kf_create_general','_kf_create_ud','_kf_create_ud_f32','_kf_update','_kf_update_f32','_kf_update_masked','_kf_update_multi','_kf_update_at','_kf_predict','_kf_set_frame_interval','_kf_enable_history','_kf_enable_fixed_lag','_kf_update_lagged','_kf_io_buffer','_kf_io_buffer_size','_kf_io_buffer_precision','_kf_update_into','_kf_update_batch','_kf_set_noise','_kf_enable_adaptive','_kf_reset_gain','_kf_snapshot','_kf_restore','_kf_snapshot_all','_kf_restore_all','_kf_smooth','_kf_destroy','_generate_noisy_sine','_demo_kalman_filter','_free_data','_malloc','_free']" \
     -s EXPORTED_RUNTIME_METHODS="['ccall','cwrap']" \
     -o "$WASM_OUT_DIR/kalman.js"
   
@@ -0,0 +1,174 @@
+/**
+ * @file alloc_check.cpp
+ * @brief Native check that steady-state updates never allocate.
+ *
+ * Replaces the global operator new with a counting one, creates one filter
+ * of every kind, runs a few warm-up frames (first calls may size
+ * thread-local scratch buffers), then counts allocations over many more
+ * frames of every per-frame entry point: kf_update, kf_update_at,
+ * kf_update_masked, kf_update_multi, kf_update_into, kf_update_f32 and
+ * kf_predict. kf_update_at runs over unit and fractional multi-step gaps,
+ * and kf_update_multi with one unit-weight set and with two weighted sets
+ * with missing values, so the multi-step and weighted paths are measured
+ * too. Any allocation in that window fails the check.
+ *
+ * Not part of the WASM build. From the repository root:
+ *   g++ -std=c++17 -O2 -Isrc/wasm/cpp src/wasm/cpp/bench/alloc_check.cpp \
+ *       src/wasm/cpp/kalman.cpp src/wasm/cpp/kalman_smoother.cpp -o alloc_check
+ *   ./alloc_check
+ */
+
+#include "kalman.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+static std::atomic<long> g_allocations(0);
+
+// The replacements pair malloc() and free() out of line: inlined, GCC
+// would see operator delete on a pointer from malloc(), or free() on one
+// from operator new, and warn (-Wmismatched-new-delete)
+__attribute__((noinline)) void* operator new(size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* block = std::malloc(size ? size : 1)) {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void* block) noexcept {
+    std::free(block);
+}
+
+void operator delete[](void* block) noexcept {
+    operator delete(block);
+}
+
+void operator delete(void* block, size_t) noexcept {
+    operator delete(block);
+}
+
+void operator delete[](void* block, size_t) noexcept {
+    operator delete(block);
+}
+
+static const int kWarmupFrames = 10;
+static const int kFrames = 1000;
+
+struct Subject {
+    const char* name;
+    int handle;
+    int dimensions;
+    bool f32;
+};
+
+// One frame through every entry point the filter supports; unsupported
+// ones return null, which is fine here
+static void run_frame(const Subject& subject, int frame, std::vector<double>& measurements,
+                      std::vector<float>& measurements_f32, std::vector<double>& sets,
+                      std::vector<double>& weights) {
+    int n = subject.dimensions;
+    for (int i = 0; i < n; i++) {
+        measurements[i] = double((frame + i) % 11) * 0.1;
+        measurements_f32[i] = float(measurements[i]);
+        // A unit-weight first set, then a half-weight one missing every
+        // seventh value
+        sets[i] = measurements[i];
+        sets[n + i] = measurements[i] + 0.05;
+        weights[i] = 1.0;
+        weights[n + i] = (frame + i) % 7 ? 0.5 : 0.0;
+    }
+
+    if (subject.f32) {
+        kf_update_f32(subject.handle, measurements_f32.data(), n);
+        return;
+    }
+
+    uint32_t mask[4] = {0xfffffffeu, 0xffffffffu, 0xffffffffu, 0xffffffffu};
+    kf_update(subject.handle, measurements.data(), n);
+    // Four frame intervals per frame, in gaps of 1.5, 1 and 1.5 steps
+    double time = frame * 4.0 / 30.0;
+    kf_update_at(subject.handle, measurements.data(), n, time);
+    kf_update_at(subject.handle, measurements.data(), n, time + 1.0 / 30.0);
+    kf_update_at(subject.handle, measurements.data(), n, time + 2.5 / 30.0);
+    kf_update_masked(subject.handle, measurements.data(), n, mask);
+    kf_update_multi(subject.handle, sets.data(), weights.data(), 1, n);
+    kf_update_multi(subject.handle, sets.data(), weights.data(), 2, n);
+    kf_predict(subject.handle, 0.5 / 30.0);
+
+    double* io = static_cast<double*>(kf_io_buffer(subject.handle));
+    for (int i = 0; i < n; i++) {
+        io[i] = measurements[i];
+    }
+    kf_update_into(subject.handle);
+}
+
+// F with a coupled superdiagonal, so kf_create_model picks the dense
+// filter, and diagonal Q and R of size n
+static void coupled_model(int n, std::vector<double>& f, std::vector<double>& q, std::vector<double>& r) {
+    f.assign(n * n, 0.0);
+    q.assign(n * n, 0.0);
+    r.assign(n * n, 0.0);
+    for (int i = 0; i < n; i++) {
+        f[i * n + i] = 1.0;
+        if (i + 1 < n) {
+            f[i * n + i + 1] = 0.1;
+        }
+        q[i * n + i] = 0.01;
+        r[i * n + i] = 0.1;
+    }
+}
+
+int main() {
+    std::vector<double> f3, q3, r3, f4, q4, r4, f5, q5, r5;
+    coupled_model(3, f3, q3, r3);
+    coupled_model(4, f4, q4, r4);
+    coupled_model(5, f5, q5, r5);  // No fixed-size instantiation
+
+    std::vector<Subject> subjects = {
+        {"diagonal", kf_create(63, 0.01, 0.1), 63, false},
+        {"f32", kf_create_f32(63, 0.01, 0.1), 63, true},
+        {"steady", kf_create_steady(63, 0.01, 0.1), 63, false},
+        {"shared", kf_create_shared(63, 0.01, 0.1), 63, false},
+        {"velocity", kf_create_motion(21, KF_MODEL_CONSTANT_VELOCITY, 0.5, 0.1), 21, false},
+        {"dense3", kf_create_model(3, f3.data(), q3.data(), r3.data()), 3, false},
+        {"dense5", kf_create_model(5, f5.data(), q5.data(), r5.data()), 5, false},
+        {"general", kf_create_general(4, 4, f4.data(), f4.data(), q4.data(), r4.data()), 4, false},
+        {"ud", kf_create_ud(4, 4, f4.data(), f4.data(), q4.data(), r4.data()), 4, false},
+        {"ud_f32", kf_create_ud_f32(4, 4, f4.data(), f4.data(), q4.data(), r4.data()), 4, true},
+    };
+
+    std::vector<double> measurements(63), sets(2 * 63), weights(2 * 63);
+    std::vector<float> measurements_f32(63);
+    int failures = 0;
+    for (const Subject& subject : subjects) {
+        if (!subject.handle) {
+            std::printf("FAIL %-9s could not be created\n", subject.name);
+            failures++;
+            continue;
+        }
+
+        int frame = 0;
+        for (; frame < kWarmupFrames; frame++) {
+            run_frame(subject, frame, measurements, measurements_f32, sets, weights);
+        }
+        long before = g_allocations.load();
+        for (; frame < kWarmupFrames + kFrames; frame++) {
+            run_frame(subject, frame, measurements, measurements_f32, sets, weights);
+        }
+        long allocations = g_allocations.load() - before;
+
+        std::printf("%s %-9s %ld allocations in %d frames\n", allocations ? "FAIL" : "ok  ",
+                    subject.name, allocations, kFrames);
+        failures += allocations != 0;
+        kf_destroy(subject.handle);
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,150 @@
+/**
+ * @file batch_check.cpp
+ * @brief Native check and timing of kf_update_batch against kf_update.
+ *
+ * Runs the same frames through two identical sets of filters, one with a
+ * kf_update call per filter and one with a single kf_update_batch call per
+ * frame, and requires bit-identical estimates. The set mixes diagonal
+ * filters with different noise, steady-state and adaptive filters,
+ * motion-model filters, a handle listed twice and an invalid handle, whose
+ * rows must come back NaN. Then times both paths over many kf_create
+ * filters; the batch should cost no more than the separate calls, which
+ * is the bar any cross-filter (structure-of-arrays) path has to clear.
+ *
+ * Not part of the WASM build. From the repository root:
+ *   g++ -std=c++17 -O3 -Isrc/wasm/cpp src/wasm/cpp/bench/batch_check.cpp \
+ *       src/wasm/cpp/kalman.cpp src/wasm/cpp/kalman_smoother.cpp -o batch_check
+ *   ./batch_check
+ */
+
+#include "kalman.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static const int kDimensions = 63;
+static const int kFrames = 300;
+
+static double measurement(int frame, int filter, int channel) {
+    return std::sin(0.05 * frame + 0.3 * filter + channel) + 0.01 * ((frame * 13 + channel) % 7);
+}
+
+// One filter of the mixed set; both copies are created the same way
+static int create(int i) {
+    switch (i % 6) {
+        case 0:  return kf_create(kDimensions, 0.01, 0.1);
+        case 1:  return kf_create(kDimensions, 0.001 * (i + 1), 0.05);
+        case 2:  return kf_create_steady(kDimensions, 0.01, 0.1);
+        case 3: {
+            int handle = kf_create(kDimensions, 0.01, 0.1);
+            kf_enable_adaptive(handle, 30);
+            return handle;
+        }
+        case 4:  return kf_create_motion(kDimensions, KF_MODEL_CONSTANT_VELOCITY, 0.5, 0.1);
+        default: return kf_create(kDimensions, 1e-6, 1.0);
+    }
+}
+
+static int check_mixed() {
+    const int kFilters = 150;
+    std::vector<int> separate, batched;
+    for (int i = 0; i < kFilters; i++) {
+        separate.push_back(create(i));
+        batched.push_back(create(i));
+    }
+
+    // Filter 7 again at the end and a stale handle in the middle
+    std::vector<int> handles = batched;
+    handles.push_back(batched[7]);
+    int stale = kf_create(kDimensions, 0.01, 0.1);
+    kf_destroy(stale);
+    handles.insert(handles.begin() + 40, stale);
+
+    int count = int(handles.size());
+    std::vector<double> measurements(size_t(count) * kDimensions), out(measurements.size());
+    std::vector<double> expected(size_t(kFilters) * kDimensions), repeat(kDimensions);
+    int failures = 0;
+    for (int frame = 0; frame < kFrames; frame++) {
+        for (int f = 0; f < count; f++) {
+            for (int i = 0; i < kDimensions; i++) {
+                measurements[size_t(f) * kDimensions + i] = measurement(frame, f, i);
+            }
+        }
+
+        // The same measurements, filter by filter, in list order
+        for (int f = 0, s = 0; f < count; f++) {
+            const double* row = &measurements[size_t(f) * kDimensions];
+            if (f == 40) {
+                continue;  // The stale handle
+            }
+            if (f == count - 1) {
+                std::memcpy(repeat.data(), kf_update(separate[7], row, kDimensions), sizeof(double) * kDimensions);
+                continue;
+            }
+            const double* state = kf_update(separate[s], row, kDimensions);
+            std::memcpy(&expected[size_t(s) * kDimensions], state, sizeof(double) * kDimensions);
+            s++;
+        }
+
+        int updated = kf_update_batch(handles.data(), count, measurements.data(), kDimensions, out.data());
+        failures += updated != count - 1;
+        for (int f = 0, s = 0; f < count; f++) {
+            const double* row = &out[size_t(f) * kDimensions];
+            if (f == 40) {
+                failures += !std::isnan(row[0]);
+                continue;
+            }
+            const double* want = f == count - 1 ? repeat.data() : &expected[size_t(s++) * kDimensions];
+            failures += std::memcmp(row, want, sizeof(double) * kDimensions) != 0;
+        }
+    }
+
+    for (int i = 0; i < kFilters; i++) {
+        kf_destroy(separate[i]);
+        kf_destroy(batched[i]);
+    }
+    std::printf("%s mixed batch matches kf_update (%d mismatches)\n", failures ? "FAIL" : "ok  ", failures);
+    return failures;
+}
+
+static void time_paths(int filter_count) {
+    std::vector<int> handles;
+    for (int i = 0; i < filter_count; i++) {
+        handles.push_back(kf_create(kDimensions, 0.01, 0.1));
+    }
+    std::vector<double> measurements(size_t(filter_count) * kDimensions), out(measurements.size());
+    for (size_t i = 0; i < measurements.size(); i++) {
+        measurements[i] = std::sin(double(i));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < kFrames; frame++) {
+        for (int f = 0; f < filter_count; f++) {
+            const double* state = kf_update(handles[f], &measurements[size_t(f) * kDimensions], kDimensions);
+            std::memcpy(&out[size_t(f) * kDimensions], state, sizeof(double) * kDimensions);
+        }
+    }
+    double separate = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < kFrames; frame++) {
+        kf_update_batch(handles.data(), filter_count, measurements.data(), kDimensions, out.data());
+    }
+    double batched = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    std::printf("%5d filters: kf_update %8.1f us/frame, kf_update_batch %8.1f us/frame\n", filter_count,
+                separate / kFrames, batched / kFrames);
+    for (int handle : handles) {
+        kf_destroy(handle);
+    }
+}
+
+int main() {
+    int failures = check_mixed();
+    for (int filter_count : {16, 64, 1024}) {
+        time_paths(filter_count);
+    }
+    return failures ? 1 : 0;
+}
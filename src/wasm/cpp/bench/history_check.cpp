@@ -0,0 +1,107 @@
+/**
+ * @file history_check.cpp
+ * @brief Native check that late kf_update_at measurements replay correctly.
+ *
+ * Sends the same timestamped frames to three filters of each kind: one in
+ * order, one with a frame delivered late from a separate buffer, and one
+ * with the same late frame delivered through kf_io_buffer, the way the
+ * loader's updateAt does. The update overwrites the I/O buffer with the
+ * estimate, so this catches a history ring that records estimates instead
+ * of measurements. All three must end on the same estimate.
+ *
+ * Not part of the WASM build. From the repository root:
+ *   g++ -std=c++17 -O2 -Isrc/wasm/cpp src/wasm/cpp/bench/history_check.cpp \
+ *       src/wasm/cpp/kalman.cpp src/wasm/cpp/kalman_smoother.cpp -o history_check
+ *   ./history_check
+ */
+
+#include "kalman.h"
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+static const int kFrames = 8;
+static const int kLateFrame = 2;
+static const double kFrameInterval = 1.0 / 30.0;
+static const double kTolerance = 1e-12;
+
+static double measurement(int frame, int channel) {
+    return std::sin(0.7 * frame + channel) + 0.1 * ((frame * 7 + channel) % 5);
+}
+
+// Delivery order with kLateFrame moved after the frame that follows it
+static std::vector<int> late_order() {
+    std::vector<int> order;
+    for (int frame = 0; frame < kFrames; frame++) {
+        if (frame != kLateFrame) {
+            order.push_back(frame);
+        }
+        if (frame == kLateFrame + 1) {
+            order.push_back(kLateFrame);
+        }
+    }
+    return order;
+}
+
+// Feed frames in `order`, from a private buffer or through kf_io_buffer,
+// and return the final estimate
+static std::vector<double> run(int handle, int dimensions, const std::vector<int>& order, bool io) {
+    kf_enable_history(handle, 16);
+    std::vector<double> buffer(dimensions), result;
+    for (int frame : order) {
+        double* input = io ? static_cast<double*>(kf_io_buffer(handle)) : buffer.data();
+        for (int i = 0; i < dimensions; i++) {
+            input[i] = measurement(frame, i);
+        }
+        double* state = kf_update_at(handle, input, dimensions, frame * kFrameInterval);
+        if (!state) {
+            result.clear();
+            break;
+        }
+        result.assign(state, state + dimensions);
+    }
+    kf_destroy(handle);
+    return result;
+}
+
+static int check(const char* name, int dimensions, const std::function<int()>& create) {
+    std::vector<int> in_order;
+    for (int frame = 0; frame < kFrames; frame++) {
+        in_order.push_back(frame);
+    }
+
+    std::vector<double> expected = run(create(), dimensions, in_order, false);
+    std::vector<double> separate = run(create(), dimensions, late_order(), false);
+    std::vector<double> io = run(create(), dimensions, late_order(), true);
+
+    double separate_error = 0.0, io_error = 0.0;
+    bool complete = int(expected.size()) == dimensions && int(separate.size()) == dimensions &&
+                    int(io.size()) == dimensions;
+    for (int i = 0; complete && i < dimensions; i++) {
+        separate_error = std::fmax(separate_error, std::fabs(separate[i] - expected[i]));
+        io_error = std::fmax(io_error, std::fabs(io[i] - expected[i]));
+    }
+
+    bool ok = complete && separate_error <= kTolerance && io_error <= kTolerance;
+    std::printf("%s %-9s separate %.3g io %.3g\n", ok ? "ok  " : "FAIL", name, separate_error, io_error);
+    return ok ? 0 : 1;
+}
+
+int main() {
+    std::vector<double> f(9, 0.0), q(9, 0.0), r(9, 0.0);
+    for (int i = 0; i < 3; i++) {
+        f[i * 3 + i] = 1.0;
+        q[i * 3 + i] = 0.01;
+        r[i * 3 + i] = 0.1;
+    }
+    f[1] = 0.1;  // Coupled, so kf_create_model picks the dense filter
+
+    int failures = 0;
+    failures += check("diagonal", 21, [] { return kf_create(21, 0.01, 0.1); });
+    failures += check("velocity", 21, [] { return kf_create_motion(21, KF_MODEL_CONSTANT_VELOCITY, 0.5, 0.1); });
+    failures += check("shared", 21, [] { return kf_create_shared(21, 0.01, 0.1); });
+    failures += check("dense", 3, [&] { return kf_create_model(3, f.data(), q.data(), r.data()); });
+    failures += check("ud", 3, [&] { return kf_create_ud(3, 3, f.data(), f.data(), q.data(), r.data()); });
+    return failures ? 1 : 0;
+}
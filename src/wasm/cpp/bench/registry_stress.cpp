@@ -0,0 +1,111 @@
+/**
+ * @file registry_stress.cpp
+ * @brief Native stress benchmark of the filter registry under threads.
+ *
+ * Every worker thread owns a set of 63-channel filters (one hand) and
+ * updates them round-robin for a fixed time, while one extra thread keeps
+ * creating and destroying filters. Prints the update throughput for each
+ * thread count; with a scalable registry it grows linearly up to the core
+ * count and the churn does not slow the updates down.
+ *
+ * Not part of the WASM build. From the repository root:
+ *   g++ -std=c++17 -O2 -pthread -Isrc/wasm/cpp src/wasm/cpp/bench/registry_stress.cpp \
+ *       src/wasm/cpp/kalman.cpp src/wasm/cpp/kalman_smoother.cpp -o registry_stress
+ *   ./registry_stress [seconds per run] [filters per thread] [max threads]
+ */
+
+#include "kalman.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+static const int kDimensions = 63;
+
+// Update this thread's filters until told to stop; returns the update count
+static long run_worker(int filters, const std::atomic<bool>& stop) {
+    std::vector<int> handles(filters);
+    for (int& handle : handles) {
+        handle = kf_create(kDimensions, 0.01, 0.1);
+    }
+    
+    double measurements[kDimensions];
+    long updates = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+        for (int handle : handles) {
+            for (int i = 0; i < kDimensions; i++) {
+                measurements[i] = double((updates + i) & 15);
+            }
+            kf_update(handle, measurements, kDimensions);
+            updates++;
+        }
+    }
+    
+    for (int handle : handles) {
+        kf_destroy(handle);
+    }
+    return updates;
+}
+
+// Create and destroy filters in batches until told to stop
+static long run_churn(const std::atomic<bool>& stop) {
+    std::vector<int> handles(64);
+    long cycles = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+        for (int& handle : handles) {
+            handle = kf_create(kDimensions, 0.01, 0.1);
+        }
+        for (int handle : handles) {
+            kf_destroy(handle);
+        }
+        cycles += long(handles.size());
+    }
+    return cycles;
+}
+
+int main(int argc, char** argv) {
+    double seconds = argc > 1 ? std::atof(argv[1]) : 1.0;
+    int filters = argc > 2 ? std::atoi(argv[2]) : 16;
+    int cores = std::max(1, int(std::thread::hardware_concurrency()));
+    int max_threads = argc > 3 ? std::atoi(argv[3]) : cores;
+    
+    std::printf("%d cores, %d filters of %d channels per thread, %.1f s per run\n",
+                cores, filters, kDimensions, seconds);
+    std::printf("%8s %14s %9s %11s %14s\n", "threads", "updates/s", "speedup", "efficiency", "churn/s");
+    
+    double single = 0.0;
+    for (int threads = 1; threads <= max_threads;
+         threads = threads < max_threads ? std::min(threads * 2, max_threads) : max_threads + 1) {
+        std::atomic<bool> stop(false);
+        std::vector<long> counts(threads, 0);
+        long churn = 0;
+        
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] { counts[t] = run_worker(filters, stop); });
+        }
+        std::thread churner([&] { churn = run_churn(stop); });
+        
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        stop.store(true);
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        churner.join();
+        
+        long total = 0;
+        for (long count : counts) {
+            total += count;
+        }
+        double rate = double(total) / seconds;
+        if (threads == 1) {
+            single = rate;
+        }
+        std::printf("%8d %14.0f %8.2fx %10.0f%% %14.0f\n", threads, rate, rate / single,
+                    100.0 * rate / (single * threads), double(churn) / seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+/**
+ * @file shared_check.cpp
+ * @brief Native check that kf_create_shared matches kf_create.
+ *
+ * Runs the same measurements through a kf_create filter and a
+ * kf_create_shared filter for several noise pairs, well past the end of the
+ * shared gain table, and requires bit-identical estimates. The pairs
+ * include q = 0 and a tiny q, whose covariance never settles within the
+ * table, and a second shared filter that joins a track half way through.
+ * A snapshot taken past the table must also restore to the same estimates.
+ *
+ * Not part of the WASM build. From the repository root:
+ *   g++ -std=c++17 -O2 -Isrc/wasm/cpp src/wasm/cpp/bench/shared_check.cpp \
+ *       src/wasm/cpp/kalman.cpp src/wasm/cpp/kalman_smoother.cpp -o shared_check
+ *   ./shared_check
+ */
+
+#include "kalman.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static const int kDimensions = 21;
+static const int kFrames = 20000;  // Several times the shared table
+
+static double measurement(int frame, int channel) {
+    return std::sin(0.01 * frame + channel) + 0.05 * ((frame * 17 + channel) % 9);
+}
+
+// Largest difference between two estimate vectors; memcmp decides equality
+static double difference(const double* a, const double* b) {
+    double largest = 0.0;
+    for (int i = 0; i < kDimensions; i++) {
+        largest = std::fmax(largest, std::fabs(a[i] - b[i]));
+    }
+    return largest;
+}
+
+static int check(double process_noise, double measurement_noise) {
+    int reference = kf_create(kDimensions, process_noise, measurement_noise);
+    int shared = kf_create_shared(kDimensions, process_noise, measurement_noise);
+    int late = 0, late_reference = 0, restored = 0;
+    std::vector<double> z(kDimensions), snapshot;
+
+    int mismatches = 0;
+    double largest = 0.0;
+    for (int frame = 0; frame < kFrames; frame++) {
+        for (int i = 0; i < kDimensions; i++) {
+            z[i] = measurement(frame, i);
+        }
+        if (frame == kFrames / 2) {
+            late = kf_create_shared(kDimensions, process_noise, measurement_noise);
+            late_reference = kf_create(kDimensions, process_noise, measurement_noise);
+            std::vector<unsigned char> blob(kf_snapshot(shared, nullptr, 0));
+            kf_snapshot(shared, blob.data(), int(blob.size()));
+            restored = kf_restore(blob.data(), int(blob.size()));
+        }
+
+        const double* expected = kf_update(reference, z.data(), kDimensions);
+        const double* actual = kf_update(shared, z.data(), kDimensions);
+        mismatches += std::memcmp(expected, actual, sizeof(double) * kDimensions) != 0;
+        largest = std::fmax(largest, difference(expected, actual));
+        if (restored) {
+            const double* again = kf_update(restored, z.data(), kDimensions);
+            mismatches += std::memcmp(expected, again, sizeof(double) * kDimensions) != 0;
+        }
+        if (late) {
+            expected = kf_update(late_reference, z.data(), kDimensions);
+            actual = kf_update(late, z.data(), kDimensions);
+            mismatches += std::memcmp(expected, actual, sizeof(double) * kDimensions) != 0;
+        }
+    }
+
+    bool ok = mismatches == 0 && restored != 0;
+    std::printf("%s q %-8g r %-4g %d mismatched frames, largest difference %.3g\n", ok ? "ok  " : "FAIL",
+                process_noise, measurement_noise, mismatches, largest);
+    for (int handle : {reference, shared, late, late_reference, restored}) {
+        kf_destroy(handle);
+    }
+    return ok ? 0 : 1;
+}
+
+int main() {
+    int failures = 0;
+    failures += check(0.01, 0.1);
+    failures += check(1e-4, 1.0);
+    failures += check(1e-9, 1.0);
+    failures += check(0.0, 0.1);
+    return failures ? 1 : 0;
+}
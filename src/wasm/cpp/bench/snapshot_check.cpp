@@ -0,0 +1,184 @@
+/**
+ * @file snapshot_check.cpp
+ * @brief Native check that kf_restore rejects truncated and corrupt blobs.
+ *
+ * Snapshots one filter of every kind, then feeds kf_restore and
+ * kf_restore_all every truncation of the blobs, every header with a byte
+ * flipped, and headers forged to claim more channels than the blob holds.
+ * Truncated and forged blobs must be rejected; flipped ones may restore,
+ * but must never read outside the buffer, which AddressSanitizer checks.
+ * A flag byte (steady state, identity H, correlated R) set to anything but
+ * 0 or 1 must be rejected too, where it would otherwise land in a bool.
+ *
+ * Not part of the WASM build. From the repository root:
+ *   g++ -std=c++17 -O1 -g -fsanitize=address,undefined -Isrc/wasm/cpp \
+ *       src/wasm/cpp/bench/snapshot_check.cpp src/wasm/cpp/kalman.cpp \
+ *       src/wasm/cpp/kalman_smoother.cpp -o snapshot_check
+ *   ./snapshot_check
+ */
+
+#include "kalman.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static const int kHeaderBytes = 48;
+static const int kKindOffset = 8;
+static const int kDimensionsOffset = 12;
+static const int kModelBytesOffset = 20;
+
+// Which flag bytes a kind stores: the last byte of its model, its state, or both
+static const int kModelFlag = 1;
+static const int kStateFlag = 2;
+
+static int g_failures = 0;
+
+static void expect(bool ok, const char* name, const char* what, int detail) {
+    if (!ok) {
+        std::printf("FAIL %s: %s (%d)\n", name, what, detail);
+        g_failures++;
+    }
+}
+
+static std::vector<unsigned char> snapshot(int handle) {
+    std::vector<unsigned char> blob(kf_snapshot(handle, nullptr, 0));
+    kf_snapshot(handle, blob.data(), int(blob.size()));
+    return blob;
+}
+
+// Restore from a copy sized exactly `size`, so ASan sees any overread
+static int restore(const std::vector<unsigned char>& blob, size_t size) {
+    std::vector<unsigned char> copy(blob.begin(), blob.begin() + size);
+    return kf_restore(copy.data(), int(size));
+}
+
+static void check_flag(const char* name, const std::vector<unsigned char>& blob, size_t offset) {
+    std::vector<unsigned char> corrupt = blob;
+    corrupt[offset] ^= 1;
+    int toggled = restore(corrupt, corrupt.size());
+    expect(toggled != 0, name, "toggled flag rejected", int(offset));
+    kf_destroy(toggled);
+
+    for (uint8_t value : {2, 0x80, 0xff}) {
+        corrupt[offset] = value;
+        int invalid = restore(corrupt, corrupt.size());
+        expect(invalid == 0, name, "invalid flag byte accepted", value);
+        kf_destroy(invalid);
+    }
+}
+
+static void check_blob(const char* name, int handle, int dimensions, int flags) {
+    std::vector<double> measurements(dimensions);
+    for (int t = 0; t < 10; t++) {
+        for (int i = 0; i < dimensions; i++) {
+            measurements[i] = double((t + i) % 7);
+        }
+        kf_update(handle, measurements.data(), dimensions);
+    }
+
+    std::vector<unsigned char> blob = snapshot(handle);
+    int restored = restore(blob, blob.size());
+    expect(restored != 0, name, "intact blob rejected", int(blob.size()));
+    kf_destroy(restored);
+
+    for (size_t size = 0; size < blob.size(); size++) {
+        int truncated = restore(blob, size);
+        expect(truncated == 0, name, "truncated blob accepted", int(size));
+        kf_destroy(truncated);
+    }
+
+    for (int offset = 0; offset < kHeaderBytes; offset++) {
+        for (int flip : {0x01, 0x10, 0x80, 0xff}) {
+            std::vector<unsigned char> corrupt = blob;
+            corrupt[offset] ^= uint8_t(flip);
+            kf_destroy(restore(corrupt, corrupt.size()));
+        }
+    }
+
+    // More channels than the blob holds, with the header's byte counts
+    // still adding up to the blob size
+    for (int32_t forged : {dimensions + 1, 1000, int32_t(blob.size()) - kHeaderBytes}) {
+        std::vector<unsigned char> corrupt = blob;
+        std::memcpy(&corrupt[kDimensionsOffset], &forged, sizeof(forged));
+        std::memcpy(&corrupt[kDimensionsOffset + 4], &forged, sizeof(forged));
+        int forged_handle = restore(corrupt, corrupt.size());
+        expect(forged_handle == 0, name, "forged dimensions accepted", forged);
+        kf_destroy(forged_handle);
+    }
+
+    // Every kind with this blob's header and payload
+    for (uint32_t kind = 0; kind < 12; kind++) {
+        std::vector<unsigned char> corrupt = blob;
+        std::memcpy(&corrupt[kKindOffset], &kind, sizeof(kind));
+        kf_destroy(restore(corrupt, corrupt.size()));
+    }
+
+    // Model bytes moved into the state bytes and back
+    uint32_t model_bytes;
+    std::memcpy(&model_bytes, &blob[kModelBytesOffset], sizeof(model_bytes));
+    for (uint32_t shift : {1u, 8u, model_bytes}) {
+        std::vector<unsigned char> corrupt = blob;
+        uint32_t sizes[2];
+        std::memcpy(sizes, &corrupt[kModelBytesOffset], sizeof(sizes));
+        sizes[0] -= shift;
+        sizes[1] += shift;
+        std::memcpy(&corrupt[kModelBytesOffset], sizes, sizeof(sizes));
+        int shifted = restore(corrupt, corrupt.size());
+        expect(shifted == 0, name, "model/state split accepted", int(shift));
+        kf_destroy(shifted);
+    }
+
+    if (flags & kModelFlag) {
+        check_flag(name, blob, kHeaderBytes + model_bytes - 1);
+    }
+    if (flags & kStateFlag) {
+        check_flag(name, blob, blob.size() - 1);
+    }
+}
+
+// F = I, H = [I 0] and diagonal Q and R for n states and m measurements
+static void general_model(int n, int m, std::vector<double>& f, std::vector<double>& h,
+                          std::vector<double>& q, std::vector<double>& r) {
+    f.assign(n * n, 0.0);
+    h.assign(m * n, 0.0);
+    q.assign(n * n, 0.0);
+    r.assign(m * m, 0.0);
+    for (int i = 0; i < n; i++) {
+        f[i * n + i] = 1.0;
+        q[i * n + i] = 0.01;
+    }
+    for (int i = 0; i < m; i++) {
+        h[i * n + i] = 1.0;
+        r[i * m + i] = 0.1;
+    }
+}
+
+int main() {
+    std::vector<double> f, h, q, r;
+    general_model(4, 2, f, h, q, r);
+
+    check_blob("diagonal", kf_create(63, 0.01, 0.1), 63, kStateFlag);
+    check_blob("f32", kf_create_f32(21, 0.01, 0.1), 21, kStateFlag);
+    check_blob("shared", kf_create_shared(21, 0.01, 0.1), 21, kStateFlag);
+    check_blob("velocity", kf_create_motion(21, KF_MODEL_CONSTANT_VELOCITY, 0.5, 0.1), 21, kStateFlag);
+    check_blob("general", kf_create_general(4, 2, f.data(), h.data(), q.data(), r.data()), 2,
+               kModelFlag | kStateFlag);
+    check_blob("ud", kf_create_ud(4, 2, f.data(), h.data(), q.data(), r.data()), 2, kModelFlag);
+    general_model(3, 3, f, h, q, r);
+    f[1] = 0.1;  // Coupled, so kf_create_model picks the dense filter
+    check_blob("dense", kf_create_model(3, f.data(), q.data(), r.data()), 3, kModelFlag | kStateFlag);
+
+    // Sets: every truncation of a kf_snapshot_all blob restores nothing
+    std::vector<unsigned char> all(kf_snapshot_all(nullptr, 0));
+    kf_snapshot_all(all.data(), int(all.size()));
+    std::vector<int> handles(64);
+    for (size_t size = 0; size < all.size(); size++) {
+        std::vector<unsigned char> copy(all.begin(), all.begin() + size);
+        int count = kf_restore_all(copy.data(), int(size), handles.data(), 32);
+        expect(count == 0, "set", "truncated set accepted", int(size));
+    }
+
+    std::printf(g_failures ? "%d failures\n" : "ok\n", g_failures);
+    return g_failures ? 1 : 0;
+}
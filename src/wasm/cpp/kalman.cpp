@@ -1,236 +1,3334 @@
 #include "kalman.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
-#include <unordered_map>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <type_traits>
 #include <vector>
 #include "emscripten.h"
+#include "kalman_matrix.h"
+#include "kalman_pool.h"
 
-// A simple matrix class for the Kalman filter
-class Matrix {
+// Seconds per filter step until kf_set_frame_interval says otherwise
+static const double kDefaultFrameInterval = 1.0 / 30.0;
+
+// Timestamped updates and predictions are clamped to this many steps, so a
+// long tracking gap cannot turn into an unbounded loop over F
+static const double kMaxTimeSteps = 1024.0;
+
+// Timestamped gaps within this many steps of one frame interval count as
+// exactly one step. Frame timestamps jitter, and a gap of 0.9995 steps
+// would otherwise take the general path: no frozen steady-state gain, F
+// raised to a fractional power and no adaptive noise estimation.
+static const double kUnitStepTolerance = 1e-3;
+
+// Converts timestamps into (possibly fractional) numbers of filter steps
+struct FilterClock {
+    FilterClock() : frame_interval(kDefaultFrameInterval), last_timestamp(0.0), started(false) {}
+    
+    double frame_interval;  // Seconds covered by one application of F
+    double last_timestamp;  // Time of the last timestamped update
+    bool started;           // Whether last_timestamp is valid
+};
+
+// Sequential copies of filter state into and out of a snapshot buffer
+class StateWriter {
+public:
+    explicit StateWriter(unsigned char* out) : out_(out) {}
+    
+    template <typename T>
+    void write(const T* values, size_t count) {
+        std::memcpy(out_, values, count * sizeof(T));
+        out_ += count * sizeof(T);
+    }
+    
+    // A flag as one byte, 0 or 1, whatever the size of bool
+    void write_flag(bool flag) {
+        uint8_t value = flag ? 1 : 0;
+        write(&value, 1);
+    }
+    
+private:
+    unsigned char* out_;
+};
+
+class StateReader {
 public:
-    Matrix(int rows, int cols) : rows_(rows), cols_(cols), data_(rows * cols, 0.0) {}
+    explicit StateReader(const unsigned char* in) : in_(in) {}
+    
+    template <typename T>
+    void read(T* values, size_t count) {
+        std::memcpy(values, in_, count * sizeof(T));
+        in_ += count * sizeof(T);
+    }
+    
+    // A flag written by write_flag(). Any other byte than 0 or 1 means a
+    // corrupt blob, so the flag is left alone and false returned.
+    bool read_flag(bool& flag) {
+        uint8_t value;
+        read(&value, 1);
+        if (value > 1) {
+            return false;
+        }
+        flag = value == 1;
+        return true;
+    }
     
-    double& operator()(int row, int col) {
-        return data_[row * cols_ + col];
+private:
+    const unsigned char* in_;
+};
+
+// Fixed-capacity ring of the most recent timestamped updates, oldest first,
+// used to apply late measurements. Each entry keeps the measurement, its
+// timestamp and a snapshot of the filter state right after it was applied.
+// Everything is allocated up front, so recording an update never allocates.
+class StateHistory {
+public:
+    StateHistory(int capacity, int dimensions, size_t state_bytes)
+        : capacity_(capacity),
+          dimensions_(dimensions),
+          state_bytes_(state_bytes),
+          head_(0),
+          size_(0),
+          timestamps_(capacity),
+          measurements_(size_t(capacity) * dimensions),
+          states_(size_t(capacity) * state_bytes),
+          replay_count_(0),
+          replay_timestamps_(capacity),
+          replay_measurements_(size_t(capacity) * dimensions),
+          staged_(dimensions)
+    {
     }
     
-    double operator()(int row, int col) const {
-        return data_[row * cols_ + col];
+    int size() const { return size_; }
+    double timestamp(int i) const { return timestamps_[slot(i)]; }
+    const unsigned char* state(int i) const { return &states_[slot(i) * state_bytes_]; }
+    
+    // Copy the measurements of the next entry before the update runs: the
+    // caller may pass the filter's I/O buffer, which the update overwrites
+    void stage(const double* measurements) {
+        std::copy(measurements, measurements + dimensions_, staged_.begin());
     }
     
-    // Matrix multiplication
-    Matrix operator*(const Matrix& other) const {
-        if (cols_ != other.rows_) {
-            // Dimensions don't match, return empty matrix
-            return Matrix(0, 0);
+    // Append an entry with the staged measurements, dropping the oldest one
+    // when full. Returns the buffer the caller fills with the filter's
+    // snapshot.
+    unsigned char* push(double time) {
+        int index;
+        if (size_ < capacity_) {
+            index = slot(size_++);
+        } else {
+            index = head_;
+            head_ = (head_ + 1) % capacity_;
         }
         
-        Matrix result(rows_, other.cols_);
-        for (int i = 0; i < rows_; i++) {
-            for (int j = 0; j < other.cols_; j++) {
-                double sum = 0.0;
-                for (int k = 0; k < cols_; k++) {
-                    sum += (*this)(i, k) * other(k, j);
-                }
-                result(i, j) = sum;
-            }
+        timestamps_[index] = time;
+        std::copy(staged_.begin(), staged_.end(), &measurements_[size_t(index) * dimensions_]);
+        return &states_[index * state_bytes_];
+    }
+    
+    // Number of entries, oldest first, taken no later than `time`
+    int count_until(double time) const {
+        int count = 0;
+        while (count < size_ && timestamp(count) <= time) {
+            count++;
+        }
+        return count;
+    }
+    
+    // Drop every entry from `keep` on, moving their measurements to the
+    // replay buffer so they can be applied again after a late one
+    void detach_after(int keep) {
+        replay_count_ = size_ - keep;
+        for (int i = 0; i < replay_count_; i++) {
+            int index = slot(keep + i);
+            replay_timestamps_[i] = timestamps_[index];
+            std::copy(&measurements_[size_t(index) * dimensions_],
+                      &measurements_[size_t(index) * dimensions_] + dimensions_,
+                      &replay_measurements_[size_t(i) * dimensions_]);
         }
-        return result;
+        size_ = keep;
+    }
+    
+    int replay_count() const { return replay_count_; }
+    double replay_timestamp(int i) const { return replay_timestamps_[i]; }
+    const double* replay_measurements(int i) const { return &replay_measurements_[size_t(i) * dimensions_]; }
+    
+private:
+    int slot(int i) const { return (head_ + i) % capacity_; }
+    
+    int capacity_;
+    int dimensions_;
+    size_t state_bytes_;
+    int head_;   // Oldest entry
+    int size_;
+    std::vector<double> timestamps_;
+    std::vector<double> measurements_;
+    std::vector<unsigned char> states_;
+    
+    int replay_count_;
+    std::vector<double> replay_timestamps_;
+    std::vector<double> replay_measurements_;
+    
+    std::vector<double> staged_;  // Measurements of the update in flight
+};
+
+// Filter types in a kf_snapshot blob; the values are part of the format
+enum SnapshotKind : uint32_t {
+    kSnapshotNone = 0,                 // Cannot be snapshotted
+    kSnapshotDiagonal = 1,             // DiagonalKalmanFilter<double>
+    kSnapshotDiagonalF32 = 2,          // DiagonalKalmanFilter<float>
+    kSnapshotConstantVelocity = 3,     // MotionModelFilter<2>
+    kSnapshotConstantAcceleration = 4, // MotionModelFilter<3>
+    kSnapshotShared = 5,               // SharedGainKalmanFilter
+    kSnapshotDense = 6,                // KalmanFilter<N, M, double>
+    kSnapshotUD = 7,                   // UDKalmanFilter<double>
+    kSnapshotUDF32 = 8                 // UDKalmanFilter<float>
+};
+
+// Common interface so the handle registry can hold filters of any dimension
+class KalmanFilterBase {
+public:
+    KalmanFilterBase() : history(nullptr) {}
+    virtual ~KalmanFilterBase() { delete history; }
+    
+    // Filters live in FilterPool blocks. new (PoolExtra{bytes}) reserves
+    // array storage in the same block, right behind the object.
+    static void* operator new(size_t size) { return FilterPool::allocate(size); }
+    static void* operator new(size_t size, PoolExtra extra) {
+        return FilterPool::allocate(pool_aligned(size) + extra.bytes);
+    }
+    static void operator delete(void* block) { FilterPool::release(block); }
+    static void operator delete(void* block, PoolExtra) { FilterPool::release(block); }
+    
+    // Number of measurements per update
+    virtual int dimensions() const = 0;
+    
+    // Number of estimated state values; differs from dimensions() only for
+    // filters with a non-square measurement matrix
+    virtual int state_dimensions() const { return dimensions(); }
+    
+    // Update the filter with new measurements, returns nullptr on mismatch
+    virtual const double* update(const double* measurements, int count) = 0;
+    
+    // Update with a measurement taken `steps` frame intervals after the
+    // previous one (fractional and zero steps allowed). Filters whose gain
+    // schedule is fixed per update ignore the step count.
+    virtual const double* update_steps(const double* measurements, int count, double steps) {
+        (void)steps;
+        return update(measurements, count);
+    }
+    
+    // Extrapolate the state `steps` frame intervals past the last update
+    // without changing the filter. The result is always double precision.
+    virtual const double* predict(double steps) = 0;
+    
+    // Update only the channels whose bit is set in `mask` (see
+    // channel_valid); the others just run the predict step and their
+    // measurement values are never used. Returns nullptr if unsupported.
+    virtual const double* update_masked(const double* measurements, int count, const uint32_t* mask) {
+        (void)measurements;
+        (void)count;
+        (void)mask;
+        return nullptr;
+    }
+    
+    // Update with the measurement noise of channel i divided by weights[i],
+    // as for the information-weighted mean of several measurements of the
+    // same state; channels with weight 0 only run the predict step.
+    // Returns nullptr if unsupported.
+    virtual const double* update_weighted(const double* measurements, int count, const double* weights) {
+        (void)measurements;
+        (void)count;
+        (void)weights;
+        return nullptr;
+    }
+    
+    // Single-precision variant of update() for filters created with
+    // kf_create_f32. Returns nullptr for double-precision filters.
+    virtual const float* update_f32(const float* measurements, int count) {
+        (void)measurements;
+        (void)count;
+        return nullptr;
+    }
+    
+    // Leave steady-state mode and restart the covariance from its initial
+    // value so the gain re-converges. Returns false if unsupported.
+    virtual bool reset_gain() { return false; }
+    
+    // Replace the noise levels of a model with scalar process and
+    // measurement noise, keeping the state and covariance; the gain
+    // re-converges from there. Returns false if unsupported.
+    virtual bool set_noise(double process_noise, double measurement_noise) {
+        (void)process_noise;
+        (void)measurement_noise;
+        return false;
+    }
+    
+    // Estimate the noise online from the innovations, averaging over about
+    // `window` updates; 0 stops adapting and keeps the current estimates.
+    // Returns false if unsupported.
+    virtual bool enable_adaptive(int window) {
+        (void)window;
+        return false;
     }
     
-    // Matrix addition
-    Matrix operator+(const Matrix& other) const {
-        if (rows_ != other.rows_ || cols_ != other.cols_) {
-            // Dimensions don't match, return empty matrix
-            return Matrix(0, 0);
+    // Persistent buffer of dimensions() values in the filter's own precision
+    // that lives as long as the filter. update_in_place() reads measurements
+    // from it and writes the estimates back over them.
+    virtual void* io_buffer() = 0;
+    virtual bool update_in_place() = 0;
+    
+    // Values io_buffer() holds, and the bytes of each
+    virtual int io_buffer_size() const { return dimensions(); }
+    virtual int io_value_bytes() const { return int(sizeof(double)); }
+    
+    // Everything an update changes (state, covariance, gain, mode), as a
+    // fixed-size byte snapshot that load_state() restores exactly.
+    // load_state() and load_model() return false on bytes save_state() and
+    // save_model() cannot have written, such as a flag other than 0 or 1.
+    virtual size_t state_bytes() const = 0;
+    virtual void save_state(unsigned char* out) const = 0;
+    virtual bool load_state(const unsigned char* in) = 0;
+    
+    // The model (F, H, Q, R or the filter's equivalent) as a fixed-size
+    // byte block. Together with the kind and the dimensions it rebuilds an
+    // identical filter, whose load_state() then takes a save_state() of
+    // this one. Filters that cannot be rebuilt report kSnapshotNone.
+    // load_model() reads model_bytes() bytes; filters whose model is fixed
+    // by their constructor arguments take it there instead.
+    virtual SnapshotKind snapshot_kind() const { return kSnapshotNone; }
+    virtual size_t model_bytes() const { return 0; }
+    virtual void save_model(unsigned char* out) const { (void)out; }
+    virtual bool load_model(const unsigned char* in) {
+        (void)in;
+        return true;
+    }
+    
+    // Fixed-lag smoothing: keep a window of the last lag + 1 frames, then
+    // update_lagged() runs a regular update and returns the estimate of the
+    // frame `lag` updates back, smoothed with every newer measurement.
+    // Unsupported filters return false / nullptr.
+    virtual bool enable_fixed_lag(int lag) {
+        (void)lag;
+        return false;
+    }
+    
+    virtual const double* update_lagged(const double* measurements, int count) {
+        (void)measurements;
+        (void)count;
+        return nullptr;
+    }
+    
+    FilterClock clock;
+    StateHistory* history;  // Recent timestamped updates, or nullptr
+};
+
+// Bit i of a validity mask lives in word i / 32, least significant bit first
+inline bool channel_valid(const uint32_t* mask, int channel) {
+    return (mask[channel >> 5] >> (channel & 31)) & 1u;
+}
+
+// True when the first `count` bits of a validity mask are all set
+inline bool all_channels_valid(const uint32_t* mask, int count) {
+    for (int word = 0; word < count / 32; word++) {
+        if (mask[word] != 0xffffffffu) {
+            return false;
         }
+    }
+    uint32_t tail = (1u << (count & 31)) - 1;
+    return (count & 31) == 0 || (mask[count >> 5] & tail) == tail;
+}
+
+// Scale of one channel of F after a fractional number of steps: whole
+// steps use f^k exactly, and the remainder interpolates linearly towards
+// the next step, which is also how predict() extends a matrix F
+inline double transition_power(double f, double steps) {
+    double whole = std::floor(steps);
+    double fraction = steps - whole;
+    return std::pow(f, whole) * (1.0 - fraction + fraction * f);
+}
+
+// Relative change of P per update below which the covariance (and hence the
+// gain) is treated as converged and the filter freezes its gain
+static const double kSteadyStateTolerance = 1e-9;
+
+template <typename T>
+inline bool has_settled(T previous, T current) {
+    const T tolerance = std::max(T(kSteadyStateTolerance), 4 * std::numeric_limits<T>::epsilon());
+    return std::abs(current - previous) <= tolerance * std::abs(current);
+}
+
+// Lower bound of adaptively estimated noise, relative to the noise in force
+// when adapting started, so an estimate can never collapse to zero
+static const double kAdaptiveFloor = 1e-3;
+
+// Kalman filter with compile-time state dimension N and measurement
+// dimension M, or runtime dimensions when they are kDynamic. Fixed
+// instantiations keep every matrix in std::array members with constant
+// loop trip counts; the dynamic one allocates its matrices once in the
+// constructor. In both cases the workspace is owned by the filter (and kept
+// off the small WASM stack), so update() never allocates, and each step
+// below is a single fused loop nest thanks to the expression templates in
+// kalman_matrix.h. The weighted-update and output arrays share the
+// filter's pool block, so a fixed instantiation is a single allocation.
+//
+// The measurement matrix H defaults to the identity (M = N), which the
+// update recognises and skips. dimensions() is the measurement count M.
+template <int N, int M = N, typename T = double>
+class KalmanFilter : public KalmanFilterBase {
+public:
+    // N = state_dimensions states observed through M = measurement_dimensions
+    // measurements; the model is all zero except F = I and H = I (if square)
+    // until set_model() fills it in
+    static KalmanFilter* create(int state_dimensions, int measurement_dimensions) {
+        PoolExtra arrays = {array_bytes(state_dimensions, measurement_dimensions)};
+        return new (arrays) KalmanFilter(state_dimensions, measurement_dimensions);
+    }
+    
+    int dimensions() const override { return measurement_dimensions_; }
+    int state_dimensions() const override { return state_dimensions_; }
+    
+    // Replace F, Q and R with row-major square matrices, keeping H = I.
+    // Q and R are symmetric, so only their upper triangles are read.
+    void set_model(const double* transition, const double* process_noise,
+                   const double* measurement_noise) {
+        copy_matrix(transition, transition_matrix_, state_dimensions_, state_dimensions_);
+        copy_symmetric(process_noise, process_noise_);
+        copy_symmetric(measurement_noise, measurement_noise_);
+    }
+    
+    // Replace F (N x N), H (M x N), Q (N x N) and R (M x M), all row-major
+    void set_model(const double* transition, const double* measurement_matrix,
+                   const double* process_noise, const double* measurement_noise) {
+        set_model(transition, process_noise, measurement_noise);
+        copy_matrix(measurement_matrix, measurement_matrix_, measurement_dimensions_, state_dimensions_);
         
-        Matrix result(rows_, cols_);
-        for (int i = 0; i < rows_; i++) {
-            for (int j = 0; j < cols_; j++) {
-                result(i, j) = (*this)(i, j) + other(i, j);
+        identity_measurement_ = measurement_dimensions_ == state_dimensions_;
+        for (int i = 0; i < measurement_dimensions_ && identity_measurement_; i++) {
+            for (int j = 0; j < state_dimensions_; j++) {
+                if (measurement_matrix_(i, j) != (i == j ? T(1) : T(0))) {
+                    identity_measurement_ = false;
+                    break;
+                }
             }
         }
-        return result;
     }
     
-    // Matrix subtraction
-    Matrix operator-(const Matrix& other) const {
-        if (rows_ != other.rows_ || cols_ != other.cols_) {
-            // Dimensions don't match, return empty matrix
-            return Matrix(0, 0);
+    bool reset_gain() override {
+        state_covariance_.set_identity();
+        steady_state_ = false;
+        return true;
+    }
+    
+    // Update the filter with new measurements
+    const double* update(const double* measurements, int count) override {
+        return step(measurements, count, transition_matrix_, process_noise_, true);
+    }
+    
+    // Dropping measurement j from the update zeroes column j of K; see step()
+    const double* update_masked(const double* measurements, int count, const uint32_t* mask) override {
+        return step(measurements, count, transition_matrix_, process_noise_, true, mask);
+    }
+    
+    // R becomes W^-1/2 * R * W^-1/2, which is exact for a diagonal R or
+    // equal weights. Zero weights go through the mask path.
+    const double* update_weighted(const double* measurements, int count, const double* weights) override {
+        if (count != measurement_dimensions_) {
+            return nullptr;  // Measurement dimension mismatch
         }
         
-        Matrix result(rows_, cols_);
-        for (int i = 0; i < rows_; i++) {
-            for (int j = 0; j < cols_; j++) {
-                result(i, j) = (*this)(i, j) - other(i, j);
-            }
+        std::fill(weight_mask_.begin(), weight_mask_.end(), 0u);
+        for (int i = 0; i < count; i++) {
+            bool valid = weights[i] > 0.0;
+            weight_mask_[i >> 5] |= uint32_t(valid) << (i & 31);
+            noise_scale_[i] = valid ? T(1.0 / std::sqrt(weights[i])) : T(0);
         }
-        return result;
+        return step(measurements, count, transition_matrix_, process_noise_, false,
+                    weight_mask_.data(), noise_scale_.data());
     }
     
-    // Matrix transpose
-    Matrix transpose() const {
-        Matrix result(cols_, rows_);
-        for (int i = 0; i < rows_; i++) {
-            for (int j = 0; j < cols_; j++) {
-                result(j, i) = (*this)(i, j);
+    // Over `steps` frame intervals, k = floor(steps) and a = steps - k, the
+    // partial step B = (1 - a) * I + a * F with noise a * Q comes first and
+    // then k whole steps, giving
+    //   F^k * B  and  F^k * a * Q * F^k^T + sum_{i<k} F^i * Q * F^i^T.
+    // Both are built by squaring, O(log k) products. The frozen steady-state
+    // gain only holds for single steps, so other step counts run the full
+    // update.
+    const double* update_steps(const double* measurements, int count, double steps) override {
+        if (steps == 1.0) {
+            return update(measurements, count);
+        }
+        
+        int whole = int(std::floor(steps));
+        T fraction = T(steps - whole);
+        for (int i = 0; i < state_dimensions_; i++) {
+            for (int j = 0; j < state_dimensions_; j++) {
+                T blend = fraction * transition_matrix_(i, j);
+                step_transition_(i, j) = i == j ? T(1) - fraction + blend : blend;
             }
         }
-        return result;
+        for (int i = 0; i < process_noise_.packed_size(); i++) {
+            step_process_noise_.data()[i] = process_noise_.data()[i] * fraction;
+            power_noise_.data()[i] = process_noise_.data()[i];
+        }
+        power_transition_ = transition_matrix_;
+        
+        // (power_transition_, power_noise_) cover 2^b steps at bit b of k
+        bool partial = fraction != T(0);
+        while (whole > 0) {
+            if (whole & 1) {
+                if (partial) {
+                    append_steps(power_transition_, power_noise_, step_transition_, step_process_noise_);
+                } else {
+                    step_transition_ = power_transition_;
+                    copy_packed(power_noise_, step_process_noise_);
+                    partial = true;
+                }
+            }
+            whole >>= 1;
+            if (whole > 0) {
+                append_steps(power_transition_, power_noise_, power_transition_, power_noise_);
+            }
+        }
+        
+        return step(measurements, count, step_transition_, step_process_noise_, false);
     }
     
-    // Identity matrix
-    static Matrix identity(int size) {
-        Matrix result(size, size);
-        for (int i = 0; i < size; i++) {
-            result(i, i) = 1.0;
+    // Same interpolation between F^k * x and F^(k+1) * x as update_steps()
+    const double* predict(double steps) override {
+        int whole = int(std::floor(steps));
+        T fraction = T(steps - whole);
+        
+        // Only the workspace is touched, which every update overwrites
+        predicted_state_ = state_;
+        for (int k = 0; k < whole; k++) {
+            step_state_ = transition_matrix_ * predicted_state_;
+            predicted_state_ = step_state_;
+        }
+        step_state_ = transition_matrix_ * predicted_state_;
+        
+        for (int i = 0; i < state_dimensions_; i++) {
+            T current = predicted_state_(i, 0);
+            prediction_[i] = double(current + fraction * (step_state_(i, 0) - current));
         }
-        return result;
+        return prediction_.data();
+    }
+    
+    // The output buffer doubles as the I/O buffer; update() has copied the
+    // measurements into z_ before output() overwrites them
+    void* io_buffer() override { return estimated_state_.data(); }
+    int io_buffer_size() const override { return int(estimated_state_.size()); }
+    
+    bool update_in_place() override {
+        return update(estimated_state_.data(), measurement_dimensions_) != nullptr;
+    }
+    
+    size_t state_bytes() const override {
+        size_t n = size_t(state_dimensions_);
+        size_t m = size_t(measurement_dimensions_);
+        return (n + size_t(state_covariance_.packed_size()) + n * m) * sizeof(T) + sizeof(uint8_t);
+    }
+    
+    void save_state(unsigned char* out) const override {
+        StateWriter writer(out);
+        size_t n = size_t(state_dimensions_);
+        size_t m = size_t(measurement_dimensions_);
+        writer.write(state_.data(), n);
+        writer.write(state_covariance_.data(), size_t(state_covariance_.packed_size()));
+        writer.write(kalman_gain_.data(), n * m);
+        writer.write_flag(steady_state_);
+    }
+    
+    bool load_state(const unsigned char* in) override {
+        StateReader reader(in);
+        size_t n = size_t(state_dimensions_);
+        size_t m = size_t(measurement_dimensions_);
+        reader.read(state_.data(), n);
+        reader.read(state_covariance_.data(), size_t(state_covariance_.packed_size()));
+        reader.read(kalman_gain_.data(), n * m);
+        return reader.read_flag(steady_state_);
+    }
+    
+    SnapshotKind snapshot_kind() const override {
+        return std::is_same<T, double>::value ? kSnapshotDense : kSnapshotNone;
+    }
+    
+    size_t model_bytes() const override {
+        size_t n = size_t(state_dimensions_);
+        size_t m = size_t(measurement_dimensions_);
+        size_t packed = size_t(process_noise_.packed_size() + measurement_noise_.packed_size());
+        return (n * n + m * n + packed) * sizeof(T) + sizeof(uint8_t);
     }
     
-    int rows() const { return rows_; }
-    int cols() const { return cols_; }
+    void save_model(unsigned char* out) const override {
+        StateWriter writer(out);
+        size_t n = size_t(state_dimensions_);
+        size_t m = size_t(measurement_dimensions_);
+        writer.write(transition_matrix_.data(), n * n);
+        writer.write(measurement_matrix_.data(), m * n);
+        writer.write(process_noise_.data(), size_t(process_noise_.packed_size()));
+        writer.write(measurement_noise_.data(), size_t(measurement_noise_.packed_size()));
+        writer.write_flag(identity_measurement_);
+    }
+    
+    bool load_model(const unsigned char* in) override {
+        StateReader reader(in);
+        size_t n = size_t(state_dimensions_);
+        size_t m = size_t(measurement_dimensions_);
+        reader.read(transition_matrix_.data(), n * n);
+        reader.read(measurement_matrix_.data(), m * n);
+        reader.read(process_noise_.data(), size_t(process_noise_.packed_size()));
+        reader.read(measurement_noise_.data(), size_t(measurement_noise_.packed_size()));
+        return reader.read_flag(identity_measurement_);
+    }
     
 private:
-    int rows_;
-    int cols_;
-    std::vector<double> data_;
-};
-
-// The Kalman filter implementation
-class KalmanFilter {
-public:
-    KalmanFilter(int dimensions, double process_noise, double measurement_noise)
-        : dimensions_(dimensions),
-          state_(dimensions, 1),        // State vector (x)
-          process_noise_(dimensions, dimensions),  // Process noise covariance (Q)
-          measurement_noise_(dimensions, dimensions),  // Measurement noise covariance (R)
-          state_covariance_(dimensions, dimensions),  // Error covariance matrix (P)
-          transition_matrix_(dimensions, dimensions),  // State transition matrix (F)
-          measurement_matrix_(dimensions, dimensions),  // Measurement matrix (H)
-          estimated_state_(dimensions)  // Output buffer for the estimated state
+    typedef MatrixStorage<N, N, T> StateMat;
+    typedef MatrixStorage<N, M, T> GainMat;
+    typedef MatrixStorage<M, N, T> MeasurementMat;
+    typedef SymmetricMatrix<N, T> StateCov;
+    typedef SymmetricMatrix<M, T> MeasurementCov;
+    typedef MatrixStorage<N, 1, T> StateVec;
+    typedef MatrixStorage<M, 1, T> MeasurementVec;
+    
+    KalmanFilter(int state_dimensions, int measurement_dimensions)
+        : state_dimensions_(state_dimensions),
+          measurement_dimensions_(measurement_dimensions),
+          state_(state_dimensions, 1),        // State vector (x)
+          process_noise_(state_dimensions),   // Process noise covariance (Q)
+          measurement_noise_(measurement_dimensions),  // Measurement noise covariance (R)
+          state_covariance_(state_dimensions),  // Error covariance matrix (P)
+          transition_matrix_(state_dimensions, state_dimensions),  // State transition matrix (F)
+          measurement_matrix_(measurement_dimensions, state_dimensions),  // Measurement matrix (H)
+          identity_measurement_(measurement_dimensions == state_dimensions),
+          z_(measurement_dimensions, 1),
+          predicted_state_(state_dimensions, 1),
+          predicted_covariance_(state_dimensions),
+          cross_transpose_(measurement_dimensions, state_dimensions),
+          innovation_covariance_(measurement_dimensions),
+          gain_transpose_(measurement_dimensions, state_dimensions),
+          kalman_gain_(state_dimensions, measurement_dimensions),
+          predicted_measurement_(measurement_dimensions, 1),
+          innovation_(measurement_dimensions, 1),
+          temp_(state_dimensions, state_dimensions),
+          step_transition_(state_dimensions, state_dimensions),
+          step_process_noise_(state_dimensions),
+          power_transition_(state_dimensions, state_dimensions),
+          power_noise_(state_dimensions),
+          step_state_(state_dimensions, 1),
+          steady_state_(false)
     {
-        // Initialize matrices
-        transition_matrix_ = Matrix::identity(dimensions);
-        measurement_matrix_ = Matrix::identity(dimensions);
-        
-        // Set up process noise matrix (Q)
-        for (int i = 0; i < dimensions; i++) {
-            process_noise_(i, i) = process_noise;
-        }
+        // The arrays behind the object, in the order array_bytes() counts them
+        unsigned char* storage = pool_trailing_storage(this, sizeof(*this));
+        size_t words = mask_words(measurement_dimensions);
+        size_t outputs = size_t(std::max(state_dimensions, measurement_dimensions));
+        weight_mask_ = PoolArray<uint32_t>(storage, words, 0u);
+        storage += PoolArray<uint32_t>::bytes(words);
+        noise_scale_ = PoolArray<T>(storage, measurement_dimensions, T(0));
+        storage += PoolArray<T>::bytes(measurement_dimensions);
+        // Output buffer for the estimated state, large enough to double as
+        // the measurement input of update_in_place()
+        estimated_state_ = PoolArray<double>(storage, outputs, 0.0);
+        storage += PoolArray<double>::bytes(outputs);
+        prediction_ = PoolArray<double>(storage, state_dimensions, 0.0);  // Output buffer for predict()
         
-        // Set up measurement noise matrix (R)
-        for (int i = 0; i < dimensions; i++) {
-            measurement_noise_(i, i) = measurement_noise;
+        // Initialize matrices
+        transition_matrix_ = identity<N, T>(state_dimensions);
+        if (identity_measurement_) {
+            for (int i = 0; i < state_dimensions; i++) {
+                measurement_matrix_(i, i) = T(1);
+            }
         }
         
         // Initialize state covariance matrix (P) with high uncertainty
-        for (int i = 0; i < dimensions; i++) {
-            state_covariance_(i, i) = 1.0;
+        state_covariance_.set_identity();
+    }
+    
+    // update_weighted() mask words for m measurements
+    static size_t mask_words(int m) { return size_t(m + 31) / 32; }
+    
+    // Bytes of the arrays behind the object: weight_mask_, noise_scale_,
+    // estimated_state_ and prediction_
+    static size_t array_bytes(int n, int m) {
+        return PoolArray<uint32_t>::bytes(mask_words(m)) + PoolArray<T>::bytes(size_t(m)) +
+               PoolArray<double>::bytes(size_t(std::max(n, m))) + PoolArray<double>::bytes(size_t(n));
+    }
+    
+    template <typename Dst>
+    static void copy_matrix(const double* values, Dst& dst, int rows, int cols) {
+        for (int i = 0; i < rows; i++) {
+            for (int j = 0; j < cols; j++) {
+                dst(i, j) = T(values[i * cols + j]);
+            }
         }
     }
     
-    // Update the filter with new measurements
-    const double* update(const double* measurements, int count) {
-        if (count != dimensions_) {
+    template <int Size>
+    static void copy_symmetric(const double* values, SymmetricMatrix<Size, T>& dst) {
+        int size = dst.size();
+        for (int i = 0; i < size; i++) {
+            for (int j = i; j < size; j++) {
+                dst(i, j) = T(values[i * size + j]);
+            }
+        }
+    }
+    
+    template <int Size>
+    static void copy_packed(const SymmetricMatrix<Size, T>& from, SymmetricMatrix<Size, T>& to) {
+        std::copy(from.data(), from.data() + from.packed_size(), to.data());
+    }
+    
+    // Extend the span (transition, noise) by the steps of (next_transition,
+    // next_noise), which happen after it:
+    //   noise = G * noise * G^T + next_noise,  transition = G * transition
+    // with G = next_transition. Either pair may be the same object.
+    // predicted_covariance_ is free workspace until step() fills it.
+    void append_steps(const StateMat& next_transition, const StateCov& next_noise,
+                      StateMat& transition, StateCov& noise) {
+        symmetric_multiply(next_transition.data(), state_dimensions_, noise, temp_.data());
+        symmetric_product_nt(temp_.data(), next_transition.data(), state_dimensions_, &next_noise,
+                             predicted_covariance_);
+        copy_packed(predicted_covariance_, noise);
+        temp_ = next_transition * transition;
+        transition = temp_;
+    }
+    
+    // One predict + update with the given transition and process noise,
+    // updating only the measurements valid in `mask` if one is given
+    const double* step(const double* measurements, int count, const StateMat& transition,
+                       const StateCov& process_noise, bool allow_steady_state,
+                       const uint32_t* mask = nullptr, const T* noise_scale = nullptr) {
+        if (count != measurement_dimensions_) {
             return nullptr;  // Measurement dimension mismatch
         }
         
         // Convert measurements to matrix
-        Matrix z(dimensions_, 1);
-        for (int i = 0; i < dimensions_; i++) {
-            z(i, 0) = measurements[i];
+        for (int i = 0; i < measurement_dimensions_; i++) {
+            z_(i, 0) = T(measurements[i]);
+        }
+        
+        if (steady_state_ && allow_steady_state && !mask) {
+            // Gain has converged: x = F * x + K * (z - H * F * x), no covariance work
+            predicted_state_ = transition * state_;
+            compute_innovation(nullptr);
+            state_ = predicted_state_ + kalman_gain_ * innovation_;
+            return output();
         }
         
         // 1. Predict step
         // x = F * x
-        // P = F * P * F^T + Q
-        Matrix predicted_state = transition_matrix_ * state_;
-        Matrix transition_transpose = transition_matrix_.transpose();
-        Matrix predicted_covariance = transition_matrix_ * state_covariance_ * transition_transpose + process_noise_;
+        // P = F * P * F^T + Q, computing only the upper triangle of the result
+        predicted_state_ = transition * state_;
+        symmetric_multiply(transition.data(), state_dimensions_, state_covariance_, temp_.data());
+        symmetric_product_nt(temp_.data(), transition.data(), state_dimensions_, &process_noise,
+                             predicted_covariance_);
         
         // 2. Update step
-        // K = P * H^T * (H * P * H^T + R)^-1  (Kalman gain)
-        // Here we use a simplification since H is identity matrix in our case
-        Matrix innovation_covariance = predicted_covariance + measurement_noise_;
-        
-        // Simplified inverse for diagonal matrix (assuming diagonal innovation_covariance)
-        Matrix inv_innovation_covariance(dimensions_, dimensions_);
-        for (int i = 0; i < dimensions_; i++) {
-            inv_innovation_covariance(i, i) = 1.0 / innovation_covariance(i, i);
+        // C^T = H * P, S = H * P * H^T + R = H * C + R. With H = I these
+        // are just P and P + R.
+        if (identity_measurement_) {
+            for (int i = 0; i < state_dimensions_; i++) {
+                for (int j = 0; j < state_dimensions_; j++) {
+                    cross_transpose_(i, j) = predicted_covariance_(i, j);
+                }
+            }
+            for (int i = 0; i < predicted_covariance_.packed_size(); i++) {
+                innovation_covariance_.data()[i] =
+                    predicted_covariance_.data()[i] + measurement_noise_.data()[i];
+            }
+        } else {
+            symmetric_multiply(measurement_matrix_.data(), measurement_dimensions_,
+                               predicted_covariance_, cross_transpose_.data());
+            symmetric_product_nt(measurement_matrix_.data(), cross_transpose_.data(), state_dimensions_,
+                                 &measurement_noise_, innovation_covariance_);
+        }
+        if (noise_scale) {
+            // Rescale the R already added: R(i, j) -> R(i, j) * s(i) * s(j)
+            for (int i = 0; i < measurement_dimensions_; i++) {
+                for (int j = i; j < measurement_dimensions_; j++) {
+                    innovation_covariance_(i, j) += measurement_noise_(i, j) * (noise_scale[i] * noise_scale[j] - T(1));
+                }
+            }
         }
         
-        Matrix kalman_gain = predicted_covariance * inv_innovation_covariance;
+        // K = C * S^-1, solved as S * K^T = C^T with a Cholesky factorisation
+        // of S in place; no inverse is formed. A masked measurement becomes
+        // an identity row and column of S with a zero right-hand side, which
+        // decouples it and gives it a zero gain column.
+        copy_storage(cross_transpose_, gain_transpose_);
+        if (mask) {
+            for (int i = 0; i < measurement_dimensions_; i++) {
+                if (channel_valid(mask, i)) {
+                    continue;
+                }
+                for (int j = 0; j < measurement_dimensions_; j++) {
+                    innovation_covariance_(i, j) = T(0);
+                }
+                innovation_covariance_(i, i) = T(1);
+                for (int j = 0; j < state_dimensions_; j++) {
+                    gain_transpose_(i, j) = T(0);
+                }
+            }
+        }
+        if (!cholesky_factor(innovation_covariance_)) {
+            return nullptr;  // S not positive definite, state left unchanged
+        }
+        cholesky_solve(innovation_covariance_, gain_transpose_.data(), state_dimensions_);
+        kalman_gain_ = transpose(gain_transpose_);
         
         // x = x + K * (z - H * x)
-        // Here we simplify since H is identity: (z - H * x) = (z - x)
-        Matrix innovation = z - predicted_state;
-        state_ = predicted_state + kalman_gain * innovation;
+        compute_innovation(mask);
+        state_ = predicted_state_ + kalman_gain_ * innovation_;
+        
+        // P = (I - K * H) * P = P - K * C^T, upper triangle only, then
+        // compare against the previous P while copying it over
+        symmetric_subtract_product_tn(gain_transpose_.data(), cross_transpose_.data(),
+                                      measurement_dimensions_, predicted_covariance_);
+        bool settled = true;
+        for (int i = 0; i < state_covariance_.packed_size(); i++) {
+            T covariance = predicted_covariance_.data()[i];
+            settled = settled && has_settled(state_covariance_.data()[i], covariance);
+            state_covariance_.data()[i] = covariance;
+        }
+        // The gain of a masked update has zero columns, never freeze it
+        steady_state_ = settled && !mask;
         
-        // P = (I - K * H) * P
-        // Simplify since H is identity: (I - K * H) = (I - K)
-        Matrix identity = Matrix::identity(dimensions_);
-        Matrix temp = identity - kalman_gain;
-        state_covariance_ = temp * predicted_covariance;
+        return output();
+    }
+    
+    // y = z - H * x for the predicted x, zero for masked measurements
+    void compute_innovation(const uint32_t* mask) {
+        if (identity_measurement_) {
+            for (int i = 0; i < measurement_dimensions_; i++) {
+                innovation_(i, 0) = z_(i, 0) - predicted_state_(i, 0);
+            }
+        } else {
+            predicted_measurement_ = measurement_matrix_ * predicted_state_;
+            innovation_ = z_ - predicted_measurement_;
+        }
         
-        // Copy the state to the output buffer
-        for (int i = 0; i < dimensions_; i++) {
-            estimated_state_[i] = state_(i, 0);
+        if (mask) {
+            // Masked measurements may be garbage (NaN), keep them out of K * y
+            for (int i = 0; i < measurement_dimensions_; i++) {
+                if (!channel_valid(mask, i)) {
+                    innovation_(i, 0) = T(0);
+                }
+            }
+        }
+    }
+    
+    // Element copy between storage types of the same runtime size
+    template <typename Src, typename Dst>
+    static void copy_storage(const Src& src, Dst& dst) {
+        std::copy(src.data(), src.data() + src.rows() * src.cols(), dst.data());
+    }
+    
+    // Copy the state to the output buffer
+    const double* output() {
+        for (int i = 0; i < state_dimensions_; i++) {
+            estimated_state_[i] = double(state_(i, 0));
         }
         
         return estimated_state_.data();
     }
     
-private:
-    int dimensions_;
-    Matrix state_;              // Current state (x)
-    Matrix process_noise_;      // Process noise covariance (Q)
-    Matrix measurement_noise_;  // Measurement noise covariance (R)
-    Matrix state_covariance_;   // Error covariance matrix (P)
-    Matrix transition_matrix_;  // State transition matrix (F)
-    Matrix measurement_matrix_; // Measurement matrix (H)
+    int state_dimensions_;
+    int measurement_dimensions_;
+    StateVec state_;                    // Current state (x)
+    StateCov process_noise_;            // Process noise covariance (Q)
+    MeasurementCov measurement_noise_;  // Measurement noise covariance (R)
+    StateCov state_covariance_;         // Error covariance matrix (P)
+    StateMat transition_matrix_;        // State transition matrix (F)
+    MeasurementMat measurement_matrix_; // Measurement matrix (H)
+    bool identity_measurement_;         // H == I, skip the products with H
+    
+    // Workspace reused by every update()
+    MeasurementVec z_;
+    StateVec predicted_state_;
+    StateCov predicted_covariance_;
+    MeasurementMat cross_transpose_;    // C^T = (P * H^T)^T
+    MeasurementCov innovation_covariance_;  // S, then its Cholesky factor
+    MeasurementMat gain_transpose_;     // K^T, solved in place
+    GainMat kalman_gain_;
+    MeasurementVec predicted_measurement_;
+    MeasurementVec innovation_;
+    StateMat temp_;
+    StateMat step_transition_;          // F over a non-unit time step
+    StateCov step_process_noise_;       // Q over a non-unit time step
+    StateMat power_transition_;         // F^(2^b) while squaring
+    StateCov power_noise_;              // Q over 2^b steps while squaring
+    StateVec step_state_;               // predict() workspace
+    PoolArray<uint32_t> weight_mask_;   // update_weighted() channels with weight > 0
+    PoolArray<T> noise_scale_;          // update_weighted() 1 / sqrt(weight)
     
-    std::vector<double> estimated_state_;  // Output buffer
+    bool steady_state_;  // Gain frozen, covariance no longer propagated
+    
+    PoolArray<double> estimated_state_;  // Output buffer
+    PoolArray<double> prediction_;       // predict() output buffer
 };
 
-// Global registry of Kalman filters
-static std::unordered_map<int, KalmanFilter*> g_filters;
-static int g_next_handle = 1;
-
-// C-style API implementation exposed to WebAssembly
-extern "C" {
-
-EMSCRIPTEN_KEEPALIVE
-int kf_create(int dimensions, double process_noise, double measurement_noise) {
-    if (dimensions <= 0) {
-        return 0;  // Invalid dimensions
+// Dense Kalman filter that carries P in factored form, P = U * D * U^T with
+// U unit upper triangular and D diagonal, instead of P itself. The time
+// update is Thornton's modified weighted Gram-Schmidt and the measurement
+// update Bierman's sequential scalar update, so P is symmetric and positive
+// semi-definite by construction and single precision does not drift the
+// way the (I - K * H) * P update does. R is decorrelated once up front
+// (R = Ur * Dr * Ur^T, z' = Ur^-1 * z, H' = Ur^-1 * H) so each measurement
+// can be processed on its own. O(N^3) per update, like the dense filter.
+//
+// U and D share one packed array stored by columns: column j holds U(0, j)
+// .. U(j - 1, j) followed by D(j), which is the access order of both
+// updates.
+template <typename T = double>
+class UDKalmanFilter : public KalmanFilterBase {
+public:
+    UDKalmanFilter(int state_dimensions, int measurement_dimensions)
+        : state_dimensions_(state_dimensions),
+          measurement_dimensions_(measurement_dimensions),
+          state_(state_dimensions, T(0)),
+          factors_(size_t(state_dimensions) * (state_dimensions + 1) / 2, T(0)),
+          transition_(size_t(state_dimensions) * state_dimensions, T(0)),
+          noise_factor_(size_t(state_dimensions) * state_dimensions, T(0)),
+          noise_diagonal_(state_dimensions, T(0)),
+          measurement_matrix_(size_t(measurement_dimensions) * state_dimensions, T(0)),
+          measurement_factor_(size_t(measurement_dimensions) * measurement_dimensions, T(0)),
+          measurement_variance_(measurement_dimensions, T(0)),
+          correlated_noise_(false),
+          step_transition_(size_t(state_dimensions) * state_dimensions),
+          step_power_(size_t(state_dimensions) * state_dimensions),
+          step_temp_(size_t(state_dimensions) * state_dimensions),
+          weighted_(size_t(state_dimensions) * 2 * state_dimensions),
+          weights_(2 * state_dimensions),
+          scaled_row_(2 * state_dimensions),
+          predicted_state_(state_dimensions),
+          whitened_(measurement_dimensions),
+          projected_(state_dimensions),
+          gain_(state_dimensions),
+          estimated_state_(std::max(state_dimensions, measurement_dimensions)),
+          prediction_(state_dimensions)
+    {
+        reset_gain();
     }
     
-    KalmanFilter* filter = new KalmanFilter(dimensions, process_noise, measurement_noise);
-    int handle = g_next_handle++;
-    g_filters[handle] = filter;
-    return handle;
-}
-
-EMSCRIPTEN_KEEPALIVE
-double* kf_update(int handle, const double* measurements, int count) {
-    auto it = g_filters.find(handle);
-    if (it == g_filters.end()) {
-        return nullptr;  // Invalid handle
+    int dimensions() const override { return measurement_dimensions_; }
+    int state_dimensions() const override { return state_dimensions_; }
+    
+    // Factor and store the model: F (N x N), H (M x N), Q (N x N) and
+    // R (M x M), all row-major. Returns false unless Q is positive
+    // semi-definite and R positive definite.
+    bool set_model(const double* transition, const double* measurement_matrix,
+                   const double* process_noise, const double* measurement_noise) {
+        int n = state_dimensions_;
+        int m = measurement_dimensions_;
+        std::vector<double> u(size_t(std::max(n, m)) * std::max(n, m));
+        std::vector<double> d(std::max(n, m));
+        
+        // Q = Uq * Dq * Uq^T, the columns of Uq become extra columns of the
+        // Gram-Schmidt input
+        if (!ud_factor(process_noise, n, u.data(), d.data())) {
+            return false;
+        }
+        for (int i = 0; i < n * n; i++) {
+            transition_[i] = T(transition[i]);
+            noise_factor_[i] = T(u[i]);
+        }
+        for (int i = 0; i < n; i++) {
+            noise_diagonal_[i] = T(d[i]);
+        }
+        
+        // R = Ur * Dr * Ur^T, then H' = Ur^-1 * H by back substitution
+        if (!ud_factor(measurement_noise, m, u.data(), d.data())) {
+            return false;
+        }
+        correlated_noise_ = false;
+        for (int i = 0; i < m; i++) {
+            if (!(d[i] > 0.0)) {
+                return false;
+            }
+            measurement_variance_[i] = T(d[i]);
+            for (int j = 0; j < m; j++) {
+                measurement_factor_[i * m + j] = T(u[i * m + j]);
+                correlated_noise_ = correlated_noise_ || (i != j && u[i * m + j] != 0.0);
+            }
+        }
+        for (int col = 0; col < n; col++) {
+            for (int i = m - 1; i >= 0; i--) {
+                double value = measurement_matrix[i * n + col];
+                for (int j = i + 1; j < m; j++) {
+                    value -= u[i * m + j] * double(measurement_matrix_[j * n + col]);
+                }
+                measurement_matrix_[i * n + col] = T(value);
+            }
+        }
+        return true;
     }
     
-    return const_cast<double*>(it->second->update(measurements, count));
-}
-
-EMSCRIPTEN_KEEPALIVE
-void kf_destroy(int handle) {
-    auto it = g_filters.find(handle);
-    if (it != g_filters.end()) {
-        delete it->second;
-        g_filters.erase(it);
+    // Back to P = I
+    bool reset_gain() override {
+        std::fill(factors_.begin(), factors_.end(), T(0));
+        for (int j = 0; j < state_dimensions_; j++) {
+            column(j)[j] = T(1);
+        }
+        return true;
+    }
+    
+    const double* update(const double* measurements, int count) override {
+        return step(measurements, count, 1.0);
+    }
+    
+    const double* update_steps(const double* measurements, int count, double steps) override {
+        return step(measurements, count, steps);
+    }
+    
+    // Measurements are processed one by one, so masking one out just skips
+    // it. With correlated R they are mixed by the decorrelation and cannot
+    // be dropped individually.
+    const double* update_masked(const double* measurements, int count, const uint32_t* mask) override {
+        if (correlated_noise_) {
+            return nullptr;
+        }
+        return step(measurements, count, 1.0, mask);
+    }
+    
+    // Scales each measurement's variance; needs independent measurements too
+    const double* update_weighted(const double* measurements, int count, const double* weights) override {
+        if (correlated_noise_) {
+            return nullptr;
+        }
+        return step(measurements, count, 1.0, nullptr, weights);
+    }
+    
+    const float* update_f32(const float* measurements, int count) override {
+        return step(measurements, count, 1.0);
     }
+    
+    // Same interpolation between F^k * x and F^(k+1) * x as the dense filter
+    const double* predict(double steps) override {
+        int n = state_dimensions_;
+        int whole = int(std::floor(steps));
+        double fraction = steps - whole;
+        
+        std::copy(state_.begin(), state_.end(), predicted_state_.begin());
+        for (int k = 0; k <= whole; k++) {
+            multiply(transition_.data(), predicted_state_.data(), projected_.data());
+            if (k < whole) {
+                std::copy(projected_.begin(), projected_.end(), predicted_state_.begin());
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            double current = double(predicted_state_[i]);
+            prediction_[i] = current + fraction * (double(projected_[i]) - current);
+        }
+        return prediction_.data();
+    }
+    
+    // Measurements in, state out; step() whitens the measurements into
+    // its own workspace before it writes the estimate
+    void* io_buffer() override { return estimated_state_.data(); }
+    int io_buffer_size() const override { return int(estimated_state_.size()); }
+    int io_value_bytes() const override { return int(sizeof(T)); }
+    
+    bool update_in_place() override {
+        return step(estimated_state_.data(), measurement_dimensions_, 1.0) != nullptr;
+    }
+    
+    size_t state_bytes() const override {
+        return (state_.size() + factors_.size()) * sizeof(T);
+    }
+    
+    void save_state(unsigned char* out) const override {
+        StateWriter writer(out);
+        writer.write(state_.data(), state_.size());
+        writer.write(factors_.data(), factors_.size());
+    }
+    
+    bool load_state(const unsigned char* in) override {
+        StateReader reader(in);
+        reader.read(state_.data(), state_.size());
+        reader.read(factors_.data(), factors_.size());
+        return true;
+    }
+    
+    // The factored model as stored, so a rebuilt filter matches bit for bit
+    SnapshotKind snapshot_kind() const override {
+        return std::is_same<T, float>::value ? kSnapshotUDF32 : kSnapshotUD;
+    }
+    
+    size_t model_bytes() const override {
+        size_t values = transition_.size() + noise_factor_.size() + noise_diagonal_.size() +
+                        measurement_matrix_.size() + measurement_factor_.size() +
+                        measurement_variance_.size();
+        return values * sizeof(T) + sizeof(uint8_t);
+    }
+    
+    void save_model(unsigned char* out) const override {
+        StateWriter writer(out);
+        writer.write(transition_.data(), transition_.size());
+        writer.write(noise_factor_.data(), noise_factor_.size());
+        writer.write(noise_diagonal_.data(), noise_diagonal_.size());
+        writer.write(measurement_matrix_.data(), measurement_matrix_.size());
+        writer.write(measurement_factor_.data(), measurement_factor_.size());
+        writer.write(measurement_variance_.data(), measurement_variance_.size());
+        writer.write_flag(correlated_noise_);
+    }
+    
+    bool load_model(const unsigned char* in) override {
+        StateReader reader(in);
+        reader.read(transition_.data(), transition_.size());
+        reader.read(noise_factor_.data(), noise_factor_.size());
+        reader.read(noise_diagonal_.data(), noise_diagonal_.size());
+        reader.read(measurement_matrix_.data(), measurement_matrix_.size());
+        reader.read(measurement_factor_.data(), measurement_factor_.size());
+        reader.read(measurement_variance_.data(), measurement_variance_.size());
+        return reader.read_flag(correlated_noise_);
+    }
+    
+private:
+    // Packed column j: U(0, j) .. U(j - 1, j), then D(j)
+    T* column(int j) { return factors_.data() + size_t(j) * (j + 1) / 2; }
+    
+    // out = A * x for a row-major N x N A
+    void multiply(const T* a, const T* x, T* out) const {
+        int n = state_dimensions_;
+        for (int i = 0; i < n; i++) {
+            T sum = T(0);
+            for (int k = 0; k < n; k++) {
+                sum += a[i * n + k] * x[k];
+            }
+            out[i] = sum;
+        }
+    }
+    
+    // out = a * b, all N x N; out must not alias a or b
+    void multiply_square(const T* a, const T* b, T* out) const {
+        int n = state_dimensions_;
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                T sum = T(0);
+                for (int p = 0; p < n; p++) {
+                    sum += a[i * n + p] * b[p * n + j];
+                }
+                out[i * n + j] = sum;
+            }
+        }
+    }
+    
+    // F over `steps` intervals: F^k * ((1 - a) * I + a * F), as in the
+    // dense filter, with F^k by repeated squaring
+    const T* step_transition(double steps) {
+        if (steps == 1.0) {
+            return transition_.data();
+        }
+        
+        int n = state_dimensions_;
+        int whole = int(std::floor(steps));
+        T fraction = T(steps - whole);
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                T blend = fraction * transition_[i * n + j];
+                step_transition_[i * n + j] = i == j ? T(1) - fraction + blend : blend;
+            }
+        }
+        std::copy(transition_.begin(), transition_.end(), step_power_.begin());
+        while (whole > 0) {
+            if (whole & 1) {
+                multiply_square(step_power_.data(), step_transition_.data(), step_temp_.data());
+                std::swap(step_transition_, step_temp_);
+            }
+            whole >>= 1;
+            if (whole > 0) {
+                multiply_square(step_power_.data(), step_power_.data(), step_temp_.data());
+                std::swap(step_power_, step_temp_);
+            }
+        }
+        return step_transition_.data();
+    }
+    
+    // Thornton time update. The rows of W = [F * U, Uq] with weights
+    // [D, Dq * steps] satisfy W * diag(weights) * W^T = F * P * F^T + Q;
+    // orthogonalising them from the last row up yields the new U and D.
+    void time_update(const T* transition, double steps) {
+        int n = state_dimensions_;
+        int width = 2 * n;
+        
+        for (int r = 0; r < n; r++) {
+            T* row = &weighted_[size_t(r) * width];
+            const T* f_row = transition + r * n;
+            for (int c = 0; c < n; c++) {
+                const T* u = column(c);
+                T sum = f_row[c];  // U(c, c) = 1
+                for (int k = 0; k < c; k++) {
+                    sum += f_row[k] * u[k];
+                }
+                row[c] = sum;
+            }
+            std::copy(&noise_factor_[size_t(r) * n], &noise_factor_[size_t(r) * n] + n, row + n);
+        }
+        for (int j = 0; j < n; j++) {
+            weights_[j] = column(j)[j];
+            weights_[n + j] = noise_diagonal_[j] * T(steps);
+        }
+        
+        for (int k = n - 1; k >= 0; k--) {
+            const T* row_k = &weighted_[size_t(k) * width];
+            T sigma = T(0);
+            for (int c = 0; c < width; c++) {
+                scaled_row_[c] = weights_[c] * row_k[c];
+                sigma += scaled_row_[c] * row_k[c];
+            }
+            
+            T* u = column(k);
+            u[k] = sigma;
+            for (int j = 0; j < k; j++) {
+                T* row_j = &weighted_[size_t(j) * width];
+                if (!(sigma > T(0))) {
+                    u[j] = T(0);  // No uncertainty left in this direction
+                    continue;
+                }
+                T dot = T(0);
+                for (int c = 0; c < width; c++) {
+                    dot += row_j[c] * scaled_row_[c];
+                }
+                T coefficient = dot / sigma;
+                u[j] = coefficient;
+                for (int c = 0; c < width; c++) {
+                    row_j[c] -= coefficient * row_k[c];
+                }
+            }
+        }
+    }
+    
+    // Bierman update with one decorrelated scalar measurement z = h * x + v,
+    // var(v) = r
+    void measurement_update(const T* h, T z, T r) {
+        int n = state_dimensions_;
+        
+        T innovation = z;
+        for (int i = 0; i < n; i++) {
+            innovation -= h[i] * state_[i];
+        }
+        
+        // f = U^T * h, then sweep the columns: D shrinks, U and the
+        // unnormalised gain b are updated together
+        T alpha = r;
+        for (int j = 0; j < n; j++) {
+            T* u = column(j);
+            T f = h[j];
+            for (int i = 0; i < j; i++) {
+                f += u[i] * h[i];
+            }
+            
+            T v = u[j] * f;  // D(j) * f(j)
+            T previous_alpha = alpha;
+            alpha += f * v;
+            u[j] *= previous_alpha / alpha;
+            
+            T correction = -f / previous_alpha;
+            for (int i = 0; i < j; i++) {
+                T old = u[i];
+                u[i] = old + gain_[i] * correction;
+                gain_[i] += old * v;
+            }
+            gain_[j] = v;
+        }
+        
+        T scale = innovation / alpha;
+        for (int i = 0; i < n; i++) {
+            state_[i] += gain_[i] * scale;
+        }
+    }
+    
+    // Run one update if the caller's precision U matches the filter's T;
+    // the result is returned in the filter's own output buffer
+    template <typename U>
+    const U* step(const U* measurements, int count, double steps, const uint32_t* mask = nullptr,
+                  const double* weights = nullptr) {
+        if (!std::is_same<U, T>::value) {
+            return nullptr;  // Precision mismatch
+        }
+        if (count != measurement_dimensions_) {
+            return nullptr;  // Measurement dimension mismatch
+        }
+        
+        // z' = Ur^-1 * z, taken before the output overwrites an in-place input
+        int m = measurement_dimensions_;
+        for (int i = m - 1; i >= 0; i--) {
+            T value = T(measurements[i]);
+            for (int j = i + 1; j < m && correlated_noise_; j++) {
+                value -= measurement_factor_[i * m + j] * whitened_[j];
+            }
+            whitened_[i] = value;
+        }
+        
+        const T* transition = step_transition(steps);
+        multiply(transition, state_.data(), predicted_state_.data());
+        std::swap(state_, predicted_state_);
+        time_update(transition, steps);
+        
+        for (int i = 0; i < m; i++) {
+            if ((mask && !channel_valid(mask, i)) || (weights && !(weights[i] > 0.0))) {
+                continue;
+            }
+            T variance = weights ? T(double(measurement_variance_[i]) / weights[i]) : measurement_variance_[i];
+            measurement_update(&measurement_matrix_[size_t(i) * state_dimensions_], whitened_[i], variance);
+        }
+        
+        std::copy(state_.begin(), state_.end(), estimated_state_.begin());
+        return reinterpret_cast<const U*>(estimated_state_.data());
+    }
+    
+    int state_dimensions_;
+    int measurement_dimensions_;
+    std::vector<T> state_;                 // x
+    std::vector<T> factors_;               // U and D, packed by columns
+    std::vector<T> transition_;            // F
+    std::vector<T> noise_factor_;          // Uq, row-major
+    std::vector<T> noise_diagonal_;        // Dq
+    std::vector<T> measurement_matrix_;    // Ur^-1 * H
+    std::vector<T> measurement_factor_;    // Ur, row-major
+    std::vector<T> measurement_variance_;  // Dr
+    bool correlated_noise_;                // Ur != I
+    
+    // Workspace reused by every update
+    std::vector<T> step_transition_;       // F over a non-unit time step
+    std::vector<T> step_power_;            // F^(2^i) while squaring
+    std::vector<T> step_temp_;
+    std::vector<T> weighted_;              // Gram-Schmidt rows, N x 2N
+    std::vector<T> weights_;
+    std::vector<T> scaled_row_;
+    std::vector<T> predicted_state_;
+    std::vector<T> whitened_;              // z'
+    std::vector<T> projected_;             // predict() workspace
+    std::vector<T> gain_;                  // Unnormalised Bierman gain
+    
+    std::vector<T> estimated_state_;       // Output buffer, in the filter's precision
+    std::vector<double> prediction_;       // predict() output buffer
+};
+
+// Kalman filter for models where F, H, Q and R are all diagonal, which is
+// what kf_create builds. Every channel is then an independent scalar filter,
+// so predict and update are an O(N) loop over per-channel coefficients
+// instead of the O(N^3) dense path, and P is stored as its diagonal.
+//
+// The per-channel arrays share the filter's pool block, so create() is a
+// single allocation and one filter's data stays contiguous.
+template <typename T = double>
+class DiagonalKalmanFilter : public KalmanFilterBase {
+public:
+    static DiagonalKalmanFilter* create(int dimensions, double process_noise, double measurement_noise) {
+        PoolExtra arrays = {kArrays * PoolArray<T>::bytes(dimensions) + PoolArray<double>::bytes(dimensions)};
+        return new (arrays) DiagonalKalmanFilter(dimensions, process_noise, measurement_noise);
+    }
+    
+    int dimensions() const override { return dimensions_; }
+    
+    // Take the diagonals of row-major dimensions x dimensions F, Q and R
+    void set_model(const double* transition, const double* process_noise,
+                   const double* measurement_noise) {
+        for (int i = 0; i < dimensions_; i++) {
+            int ii = i * dimensions_ + i;
+            transition_[i] = T(transition[ii]);
+            process_noise_[i] = T(process_noise[ii]);
+            measurement_noise_[i] = T(measurement_noise[ii]);
+        }
+    }
+    
+    // Jump straight to the steady-state gain. For each channel the predicted
+    // variance s solves the scalar Riccati equation
+    //   s = f^2 * s * r / (s + r) + q
+    //   => s^2 + (r * (1 - f^2) - q) * s - q * r = 0
+    // and the gain is k = s / (s + r).
+    void precompute_steady_state() {
+        for (int i = 0; i < dimensions_; i++) {
+            double f = double(transition_[i]);
+            double q = double(process_noise_[i]);
+            double r = double(measurement_noise_[i]);
+            double b = r * (1.0 - f * f) - q;
+            double predicted_variance = 0.5 * (-b + std::sqrt(b * b + 4.0 * q * r));
+            double gain = predicted_variance / (predicted_variance + r);
+            gain_[i] = T(gain);
+            variance_[i] = T((1.0 - gain) * predicted_variance);
+        }
+        steady_state_ = true;
+    }
+    
+    bool reset_gain() override {
+        std::fill(variance_.begin(), variance_.end(), T(1));
+        steady_state_ = false;
+        return true;
+    }
+    
+    // While adapting, the new values also become the starting point and
+    // floors of the estimates, as if adapting had just been enabled
+    bool set_noise(double process_noise, double measurement_noise) override {
+        std::fill(process_noise_.begin(), process_noise_.end(), T(process_noise));
+        std::fill(measurement_noise_.begin(), measurement_noise_.end(), T(measurement_noise));
+        if (adaptive_rate_ > T(0)) {
+            seed_adaptive();
+        }
+        steady_state_ = false;
+        return true;
+    }
+    
+    // Buffers are allocated here, never per update
+    bool enable_adaptive(int window) override {
+        if (window == 0) {
+            adaptive_rate_ = T(0);
+            return true;
+        }
+        
+        adaptive_rate_ = T(1.0 / window);
+        innovation_moment_.resize(dimensions_);
+        innovation_lag_moment_.resize(dimensions_);
+        previous_measurement_.assign(dimensions_, std::numeric_limits<T>::quiet_NaN());
+        previous_innovation_.assign(dimensions_, std::numeric_limits<T>::quiet_NaN());
+        process_floor_.resize(dimensions_);
+        measurement_floor_.resize(dimensions_);
+        seed_adaptive();
+        steady_state_ = false;
+        return true;
+    }
+    
+    // Per channel:
+    //   x' = f * x,  p' = f * p * f + q
+    //   k = p' / (p' + r)
+    //   x = x' + k * (z - x'),  p = (1 - k) * p' = p' * r / (p' + r)
+    // The last form is a product of positive terms, so p cannot lose
+    // positivity to cancellation even in single precision.
+    // Once every p stops changing the gains are frozen and only the state
+    // line runs.
+    const double* update(const double* measurements, int count) override {
+        if (count != dimensions_) {
+            return nullptr;  // Measurement dimension mismatch
+        }
+        
+        return step(measurements);
+    }
+    
+    // Over `steps` frame intervals each channel uses transition_power(f)
+    // and q * steps; the frozen gains only hold for single steps
+    const double* update_steps(const double* measurements, int count, double steps) override {
+        if (count != dimensions_) {
+            return nullptr;  // Measurement dimension mismatch
+        }
+        
+        return step(measurements, steps);
+    }
+    
+    const double* update_masked(const double* measurements, int count, const uint32_t* mask) override {
+        if (count != dimensions_) {
+            return nullptr;  // Measurement dimension mismatch
+        }
+        
+        return step(measurements, 1.0, mask);
+    }
+    
+    const double* update_weighted(const double* measurements, int count, const double* weights) override {
+        if (count != dimensions_) {
+            return nullptr;  // Measurement dimension mismatch
+        }
+        
+        return step(measurements, 1.0, nullptr, weights);
+    }
+    
+    const double* predict(double steps) override {
+        for (int i = 0; i < dimensions_; i++) {
+            prediction_[i] = transition_power(double(transition_[i]), steps) * double(state_[i]);
+        }
+        return prediction_.data();
+    }
+    
+    const float* update_f32(const float* measurements, int count) override {
+        if (count != dimensions_) {
+            return nullptr;  // Measurement dimension mismatch
+        }
+        
+        return step(measurements);
+    }
+    
+    // The output buffer doubles as the I/O buffer: step() reads channel i's
+    // measurement before it writes channel i's estimate
+    void* io_buffer() override { return estimated_state_.data(); }
+    int io_value_bytes() const override { return int(sizeof(T)); }
+    
+    bool update_in_place() override {
+        return step(estimated_state_.data()) != nullptr;
+    }
+    
+    // The window is preallocated here; lag 0 releases it. Lagged updates
+    // take double-precision measurements, like kf_update.
+    bool enable_fixed_lag(int lag) override {
+        if (!std::is_same<T, double>::value) {
+            return false;
+        }
+        
+        size_t size = size_t(lag + 1) * dimensions_;
+        lag_ = lag;
+        lag_frames_ = 0;
+        lag_newest_ = 0;
+        lag_state_.assign(lag ? size : 0, T(0));
+        lag_variance_.assign(lag ? size : 0, T(0));
+        lag_predicted_variance_.assign(lag ? size : 0, T(0));
+        lag_smoothed_.assign(lag ? dimensions_ : 0, T(0));
+        lag_output_.assign(lag ? dimensions_ : 0, 0.0);
+        return true;
+    }
+    
+    // After the regular update, an RTS backward pass over the window:
+    //   c_k = p_k|k * f / p_k+1|k
+    //   xs_k = x_k|k + c_k * (xs_k+1 - f * x_k|k)
+    // from the newest frame down to the oldest, O(lag * N) per frame
+    const double* update_lagged(const double* measurements, int count) override {
+        if (!lag_ || count != dimensions_) {
+            return nullptr;  // Not enabled or dimension mismatch
+        }
+        
+        // p_t|t-1 is not kept by step(), so work it out from the last p
+        int slot = lag_frames_ ? (lag_newest_ + 1) % (lag_ + 1) : 0;
+        T* predicted_variance = &lag_predicted_variance_[size_t(slot) * dimensions_];
+        for (int i = 0; i < dimensions_; i++) {
+            predicted_variance[i] = transition_[i] * variance_[i] * transition_[i] + process_noise_[i];
+        }
+        
+        if (!update(measurements, count)) {
+            return nullptr;
+        }
+        std::copy(state_.begin(), state_.end(), &lag_state_[size_t(slot) * dimensions_]);
+        std::copy(variance_.begin(), variance_.end(), &lag_variance_[size_t(slot) * dimensions_]);
+        lag_newest_ = slot;
+        lag_frames_ = std::min(lag_frames_ + 1, lag_ + 1);
+        
+        if (lag_frames_ <= lag_) {
+            return nullptr;  // Window still filling
+        }
+        
+        std::copy(state_.begin(), state_.end(), lag_smoothed_.begin());
+        for (int age = 1; age <= lag_; age++) {
+            int newer = (slot + lag_ + 1 - (age - 1)) % (lag_ + 1);
+            int older = (slot + lag_ + 1 - age) % (lag_ + 1);
+            const T* state = &lag_state_[size_t(older) * dimensions_];
+            const T* variance = &lag_variance_[size_t(older) * dimensions_];
+            const T* next_predicted = &lag_predicted_variance_[size_t(newer) * dimensions_];
+            for (int i = 0; i < dimensions_; i++) {
+                T f = transition_[i];
+                T smoother_gain = variance[i] * f / next_predicted[i];
+                lag_smoothed_[i] = state[i] + smoother_gain * (lag_smoothed_[i] - f * state[i]);
+            }
+        }
+        
+        for (int i = 0; i < dimensions_; i++) {
+            lag_output_[i] = double(lag_smoothed_[i]);
+        }
+        return lag_output_.data();
+    }
+    
+    size_t state_bytes() const override {
+        return 3 * size_t(dimensions_) * sizeof(T) + sizeof(uint8_t);
+    }
+    
+    void save_state(unsigned char* out) const override {
+        StateWriter writer(out);
+        writer.write(state_.data(), state_.size());
+        writer.write(variance_.data(), variance_.size());
+        writer.write(gain_.data(), gain_.size());
+        writer.write_flag(steady_state_);
+    }
+    
+    bool load_state(const unsigned char* in) override {
+        StateReader reader(in);
+        reader.read(state_.data(), state_.size());
+        reader.read(variance_.data(), variance_.size());
+        reader.read(gain_.data(), gain_.size());
+        return reader.read_flag(steady_state_);
+    }
+    
+    // diag(F), diag(Q) and diag(R); adaptive estimates are part of Q and R
+    SnapshotKind snapshot_kind() const override {
+        return std::is_same<T, float>::value ? kSnapshotDiagonalF32 : kSnapshotDiagonal;
+    }
+    
+    size_t model_bytes() const override {
+        return 3 * size_t(dimensions_) * sizeof(T);
+    }
+    
+    void save_model(unsigned char* out) const override {
+        StateWriter writer(out);
+        writer.write(transition_.data(), transition_.size());
+        writer.write(process_noise_.data(), process_noise_.size());
+        writer.write(measurement_noise_.data(), measurement_noise_.size());
+    }
+    
+    bool load_model(const unsigned char* in) override {
+        StateReader reader(in);
+        reader.read(transition_.data(), transition_.size());
+        reader.read(process_noise_.data(), process_noise_.size());
+        reader.read(measurement_noise_.data(), measurement_noise_.size());
+        return true;
+    }
+    
+private:
+    // The running moments start where the current model puts them, so
+    // adapting does not cause a jump, and the estimates are floored at a
+    // small fraction of the current values
+    void seed_adaptive() {
+        for (int i = 0; i < dimensions_; i++) {
+            T f = transition_[i];
+            innovation_moment_[i] = process_noise_[i] + (T(1) + f * f) * measurement_noise_[i];
+            innovation_lag_moment_[i] = -f * measurement_noise_[i];
+            process_floor_[i] = process_noise_[i] * T(kAdaptiveFloor);
+            measurement_floor_[i] = measurement_noise_[i] * T(kAdaptiveFloor);
+        }
+    }
+    
+    // Estimate channel i's q and r from measurement z (NaN if the channel
+    // was not measured). The innovations of the one-step measurement
+    // predictor, y = z - f * z_prev = w + v - f * v_prev, have
+    //   E[y^2] = q + (1 + f^2) r,  E[y y_prev] = -f r
+    // whatever the filter's gain; the filter's own innovations would feed
+    // the estimates back through the gain and bias them. The new values
+    // apply from the next update on.
+    void adapt_noise(int i, T f, T measurement) {
+        T previous_measurement = previous_measurement_[i];
+        T previous = previous_innovation_[i];
+        previous_measurement_[i] = measurement;
+        T innovation = measurement - f * previous_measurement;
+        previous_innovation_[i] = innovation;
+        if (std::isnan(innovation)) {
+            return;  // Gap in either measurement
+        }
+        
+        T rate = adaptive_rate_;
+        T moment = innovation_moment_[i] + rate * (innovation * innovation - innovation_moment_[i]);
+        innovation_moment_[i] = moment;
+        if (std::isnan(previous) || std::abs(f) < T(kAdaptiveFloor)) {
+            return;  // No lag product yet, or F too small to tell r apart
+        }
+        T lag_moment = innovation_lag_moment_[i] + rate * (innovation * previous - innovation_lag_moment_[i]);
+        innovation_lag_moment_[i] = lag_moment;
+        
+        T r = std::max(-lag_moment / f, measurement_floor_[i]);
+        measurement_noise_[i] = r;
+        process_noise_[i] = std::max(moment - (T(1) + f * f) * r, process_floor_[i]);
+    }
+    
+    // Run one update if the caller's precision U matches the filter's T;
+    // the result is returned in the filter's own output buffer
+    template <typename U>
+    const U* step(const U* measurements, double steps = 1.0,
+                  const uint32_t* mask = nullptr, const double* weights = nullptr) {
+        if (!std::is_same<U, T>::value) {
+            return nullptr;  // Precision mismatch
+        }
+        
+        if (steady_state_ && steps == 1.0 && !mask && !weights) {
+            for (int i = 0; i < dimensions_; i++) {
+                T predicted_state = transition_[i] * state_[i];
+                state_[i] = predicted_state + gain_[i] * (T(measurements[i]) - predicted_state);
+                estimated_state_[i] = state_[i];
+            }
+            return reinterpret_cast<const U*>(estimated_state_.data());
+        }
+        
+        // Weighted updates scale r and multi-step ones q, so they are kept
+        // out of the estimates. Jittered timestamps still count as single
+        // steps: update_at snaps them within kUnitStepTolerance.
+        bool adaptive = adaptive_rate_ > T(0) && !weights && steps == 1.0;
+        if (adaptive_rate_ > T(0) && !adaptive) {
+            std::fill(previous_measurement_.begin(), previous_measurement_.end(),
+                      std::numeric_limits<T>::quiet_NaN());
+        }
+        bool settled = true;
+        for (int i = 0; i < dimensions_; i++) {
+            T f = steps == 1.0 ? transition_[i] : T(transition_power(double(transition_[i]), steps));
+            T q = steps == 1.0 ? process_noise_[i] : T(double(process_noise_[i]) * steps);
+            bool valid = (!mask || channel_valid(mask, i)) && (!weights || weights[i] > 0.0);
+            T r = weights && valid ? T(double(measurement_noise_[i]) / weights[i]) : measurement_noise_[i];
+            T predicted_state = f * state_[i];
+            T predicted_variance = f * variance_[i] * f + q;
+            T inv_innovation = T(1) / (predicted_variance + r);
+            T gain = predicted_variance * inv_innovation;
+            T variance = predicted_variance * r * inv_innovation;
+            T innovation = T(measurements[i]) - predicted_state;
+            
+            if (adaptive) {
+                adapt_noise(i, f, valid ? T(measurements[i]) : std::numeric_limits<T>::quiet_NaN());
+            }
+            
+            // Masked channels keep the prediction: a per-lane select, so
+            // the loop stays branch-free and vectorised
+            if (!valid) {
+                innovation = T(0);
+                variance = predicted_variance;
+            }
+            
+            settled = settled && has_settled(variance_[i], variance);
+            state_[i] = predicted_state + gain * innovation;
+            variance_[i] = variance;
+            gain_[i] = gain;
+            estimated_state_[i] = state_[i];
+        }
+        steady_state_ = settled && !mask && !weights && adaptive_rate_ == T(0);
+        
+        return reinterpret_cast<const U*>(estimated_state_.data());
+    }
+    
+    // Arrays of T behind the object, followed by prediction_
+    static const int kArrays = 7;
+    
+    DiagonalKalmanFilter(int dimensions, double process_noise, double measurement_noise)
+        : dimensions_(dimensions),
+          state_(array(0), dimensions, T(0)),              // State vector (x)
+          variance_(array(1), dimensions, T(1)),           // diag(P), high initial uncertainty
+          gain_(array(2), dimensions, T(0)),               // diag(K) from the last update
+          transition_(array(3), dimensions, T(1)),         // diag(F)
+          process_noise_(array(4), dimensions, T(process_noise)),        // diag(Q)
+          measurement_noise_(array(5), dimensions, T(measurement_noise)), // diag(R)
+          steady_state_(false),
+          estimated_state_(array(6), dimensions, T(0)),    // Output buffer
+          prediction_(array(kArrays), dimensions, 0.0),    // predict() output buffer
+          lag_(0),
+          lag_frames_(0),
+          lag_newest_(0),
+          adaptive_rate_(T(0))
+    {
+    }
+    
+    // Storage of the i-th array in the block, see create()
+    void* array(int i) {
+        return pool_trailing_storage(this, sizeof(*this)) + i * PoolArray<T>::bytes(dimensions_);
+    }
+    
+    int dimensions_;
+    PoolArray<T> state_;
+    PoolArray<T> variance_;
+    PoolArray<T> gain_;
+    PoolArray<T> transition_;
+    PoolArray<T> process_noise_;
+    PoolArray<T> measurement_noise_;
+    
+    bool steady_state_;  // Gains frozen, variances no longer propagated
+    
+    PoolArray<T> estimated_state_;     // Output buffer, in the filter's precision
+    PoolArray<double> prediction_;     // predict() output buffer
+    
+    // Fixed-lag window, lag_ + 1 frames of N values each, used as a ring
+    int lag_;
+    int lag_frames_;                     // Frames in the window
+    int lag_newest_;                     // Slot of the newest frame
+    std::vector<T> lag_state_;           // x_k|k
+    std::vector<T> lag_variance_;        // p_k|k
+    std::vector<T> lag_predicted_variance_;  // p_k|k-1
+    std::vector<T> lag_smoothed_;        // Backward pass accumulator
+    std::vector<double> lag_output_;     // update_lagged() output buffer
+    
+    // Adaptive noise estimation, off while the rate is 0
+    T adaptive_rate_;                    // 1 / window
+    std::vector<T> innovation_moment_;      // Running E[y^2]
+    std::vector<T> innovation_lag_moment_;  // Running E[y * y_prev]
+    std::vector<T> previous_measurement_;   // NaN after a gap
+    std::vector<T> previous_innovation_;    // NaN after a gap
+    std::vector<T> process_floor_;
+    std::vector<T> measurement_floor_;
+};
+
+// Closed-form per-axis kernels for the polynomial motion models. Each axis
+// carries position and velocity (Order 2) or position, velocity and
+// acceleration (Order 3), driven by continuous white noise in its highest
+// derivative, and only the position is measured. Time is counted in frame
+// intervals, so velocities are per frame. The symmetric per-axis
+// covariance is stored as its upper triangle, row by row.
+template <int Order> struct MotionKernel;
+
+template <>
+struct MotionKernel<2> {
+    // F = [1 t; 0 1]
+    // Q = q * [t^3/3 t^2/2; t^2/2 t]
+    static void noise(double tau, double q, double* terms) {
+        terms[0] = q * tau * tau * tau / 3.0;
+        terms[1] = q * tau * tau / 2.0;
+        terms[2] = q * tau;
+    }
+    
+    static void predict_state(double tau, double* x) {
+        x[0] += tau * x[1];
+    }
+    
+    // P = F * P * F^T + Q, with P = [p00 p01; p01 p11]
+    static void predict_covariance(double tau, const double* q, double* p) {
+        double p01 = p[1] + tau * p[2];
+        p[0] = p[0] + tau * (p[1] + p01) + q[0];
+        p[1] = p01 + q[1];
+        p[2] = p[2] + q[2];
+    }
+};
+
+template <>
+struct MotionKernel<3> {
+    // F = [1 t t^2/2; 0 1 t; 0 0 1]
+    // Q = q * [t^5/20 t^4/8 t^3/6; t^4/8 t^3/3 t^2/2; t^3/6 t^2/2 t]
+    static void noise(double tau, double q, double* terms) {
+        double tau2 = tau * tau;
+        double tau3 = tau2 * tau;
+        terms[0] = q * tau3 * tau2 / 20.0;
+        terms[1] = q * tau2 * tau2 / 8.0;
+        terms[2] = q * tau3 / 6.0;
+        terms[3] = q * tau3 / 3.0;
+        terms[4] = q * tau2 / 2.0;
+        terms[5] = q * tau;
+    }
+    
+    static void predict_state(double tau, double* x) {
+        x[0] += tau * x[1] + 0.5 * tau * tau * x[2];
+        x[1] += tau * x[2];
+    }
+    
+    // P = F * P * F^T + Q, with P = [p00 p01 p02; p01 p11 p12; p02 p12 p22].
+    // First the rows of A = F * P that the result needs, then A * F^T.
+    static void predict_covariance(double tau, const double* q, double* p) {
+        double half = 0.5 * tau * tau;
+        double a00 = p[0] + tau * p[1] + half * p[2];
+        double a01 = p[1] + tau * p[3] + half * p[4];
+        double a02 = p[2] + tau * p[4] + half * p[5];
+        double a11 = p[3] + tau * p[4];
+        double a12 = p[4] + tau * p[5];
+        p[0] = a00 + tau * a01 + half * a02 + q[0];
+        p[1] = a01 + tau * a02 + q[1];
+        p[2] = a02 + q[2];
+        p[3] = a11 + tau * a12 + q[3];
+        p[4] = a12 + q[4];
+        p[5] = p[5] + q[5];
+    }
+};
+
+// Constant-velocity (Order 2) or constant-acceleration (Order 3) filter.
+// dimensions() counts measured axes; every axis is an independent
+// Order-state filter with H = [1 0 ...], so an update is a handful of
+// scalar operations per axis instead of a dense (Order * N)^3 product.
+// State, covariance and gain are stored structure-of-arrays, one array per
+// component across all axes, so the per-axis loop vectorises. All of the
+// arrays live in the filter's pool block behind the object.
+template <int Order>
+class MotionModelFilter : public KalmanFilterBase {
+public:
+    static MotionModelFilter* create(int dimensions, double process_noise, double measurement_noise) {
+        PoolExtra arrays = {kArrays * PoolArray<double>::bytes(dimensions)};
+        return new (arrays) MotionModelFilter(dimensions, process_noise, measurement_noise);
+    }
+    
+    int dimensions() const override { return dimensions_; }
+    
+    // P = I, as in the other filters
+    bool reset_gain() override {
+        for (int k = 0; k < Order; k++) {
+            std::fill(covariance_[diagonal_term(k)].begin(), covariance_[diagonal_term(k)].end(), 1.0);
+            for (int j = k + 1; j < Order; j++) {
+                std::fill(covariance_[term(k, j)].begin(), covariance_[term(k, j)].end(), 0.0);
+            }
+        }
+        steady_state_ = false;
+        return true;
+    }
+    
+    bool set_noise(double process_noise, double measurement_noise) override {
+        process_noise_ = process_noise;
+        measurement_noise_ = measurement_noise;
+        steady_state_ = false;
+        return true;
+    }
+    
+    const double* update(const double* measurements, int count) override {
+        if (count != dimensions_) {
+            return nullptr;  // Measurement dimension mismatch
+        }
+        
+        return step(measurements, 1.0);
+    }
+    
+    const double* update_steps(const double* measurements, int count, double steps) override {
+        if (count != dimensions_) {
+            return nullptr;  // Measurement dimension mismatch
+        }
+        
+        return step(measurements, steps);
+    }
+    
+    const double* update_masked(const double* measurements, int count, const uint32_t* mask) override {
+        if (count != dimensions_) {
+            return nullptr;  // Measurement dimension mismatch
+        }
+        
+        return step(measurements, 1.0, mask);
+    }
+    
+    const double* update_weighted(const double* measurements, int count, const double* weights) override {
+        if (count != dimensions_) {
+            return nullptr;  // Measurement dimension mismatch
+        }
+        
+        return step(measurements, 1.0, nullptr, weights);
+    }
+    
+    // Polynomial extrapolation of the position is exact for these models
+    const double* predict(double steps) override {
+        for (int i = 0; i < dimensions_; i++) {
+            double x[Order];
+            for (int k = 0; k < Order; k++) {
+                x[k] = state_[k][i];
+            }
+            MotionKernel<Order>::predict_state(steps, x);
+            prediction_[i] = x[0];
+        }
+        return prediction_.data();
+    }
+    
+    // step() reads axis i's measurement before it writes axis i's estimate
+    void* io_buffer() override { return estimated_state_.data(); }
+    
+    bool update_in_place() override {
+        return step(estimated_state_.data(), 1.0) != nullptr;
+    }
+    
+    size_t state_bytes() const override {
+        return (2 * Order + kTerms) * size_t(dimensions_) * sizeof(double) + sizeof(uint8_t);
+    }
+    
+    void save_state(unsigned char* out) const override {
+        StateWriter writer(out);
+        for (int k = 0; k < Order; k++) {
+            writer.write(state_[k].data(), state_[k].size());
+            writer.write(gain_[k].data(), gain_[k].size());
+        }
+        for (int t = 0; t < kTerms; t++) {
+            writer.write(covariance_[t].data(), covariance_[t].size());
+        }
+        writer.write_flag(steady_state_);
+    }
+    
+    bool load_state(const unsigned char* in) override {
+        StateReader reader(in);
+        for (int k = 0; k < Order; k++) {
+            reader.read(state_[k].data(), state_[k].size());
+            reader.read(gain_[k].data(), gain_[k].size());
+        }
+        for (int t = 0; t < kTerms; t++) {
+            reader.read(covariance_[t].data(), covariance_[t].size());
+        }
+        return reader.read_flag(steady_state_);
+    }
+    
+    // q and r; the order is the kind
+    SnapshotKind snapshot_kind() const override {
+        return Order == 2 ? kSnapshotConstantVelocity : kSnapshotConstantAcceleration;
+    }
+    
+    size_t model_bytes() const override { return 2 * sizeof(double); }
+    
+    void save_model(unsigned char* out) const override {
+        StateWriter writer(out);
+        writer.write(&process_noise_, 1);
+        writer.write(&measurement_noise_, 1);
+    }
+    
+private:
+    static const int kTerms = Order * (Order + 1) / 2;
+    // state_, covariance_, gain_, estimated_state_ and prediction_
+    static const int kArrays = 2 * Order + kTerms + 2;
+    
+    MotionModelFilter(int dimensions, double process_noise, double measurement_noise)
+        : dimensions_(dimensions),
+          process_noise_(process_noise),            // q, spectral density of the highest derivative
+          measurement_noise_(measurement_noise),    // r, position measurement variance
+          steady_state_(false)
+    {
+        unsigned char* storage = pool_trailing_storage(this, sizeof(*this));
+        size_t bytes = PoolArray<double>::bytes(dimensions);
+        for (int k = 0; k < Order; k++) {
+            state_[k] = PoolArray<double>(storage + k * bytes, dimensions, 0.0);
+            gain_[k] = PoolArray<double>(storage + (Order + k) * bytes, dimensions, 0.0);
+        }
+        for (int t = 0; t < kTerms; t++) {
+            covariance_[t] = PoolArray<double>(storage + (2 * Order + t) * bytes, dimensions, 0.0);
+        }
+        estimated_state_ = PoolArray<double>(storage + (kArrays - 2) * bytes, dimensions, 0.0); // Output buffer (positions)
+        prediction_ = PoolArray<double>(storage + (kArrays - 1) * bytes, dimensions, 0.0);      // predict() output buffer
+        reset_gain();
+    }
+    
+    // Index of P(i, j), i <= j, in the packed upper triangle
+    static int term(int i, int j) { return i * Order - i * (i - 1) / 2 + (j - i); }
+    static int diagonal_term(int k) { return term(k, k); }
+    
+    // Per axis, with predicted state x and covariance P:
+    //   s = P00 + r,  k = P(0, :) / s
+    //   x = x + k * (z - x0),  P = P - k * P(0, :)
+    // P00 uses the cancellation-free form P00 * r / s. Axes masked out
+    // get k = 0 and keep the predicted x and P.
+    const double* step(const double* measurements, double steps,
+                       const uint32_t* mask = nullptr, const double* weights = nullptr) {
+        if (steady_state_ && steps == 1.0 && !mask && !weights) {
+            for (int i = 0; i < dimensions_; i++) {
+                double x[Order];
+                for (int k = 0; k < Order; k++) {
+                    x[k] = state_[k][i];
+                }
+                MotionKernel<Order>::predict_state(1.0, x);
+                double innovation = measurements[i] - x[0];
+                for (int k = 0; k < Order; k++) {
+                    state_[k][i] = x[k] + gain_[k][i] * innovation;
+                }
+                estimated_state_[i] = state_[0][i];
+            }
+            return estimated_state_.data();
+        }
+        
+        double noise[kTerms];
+        MotionKernel<Order>::noise(steps, process_noise_, noise);
+        
+        bool settled = true;
+        for (int i = 0; i < dimensions_; i++) {
+            double x[Order];
+            double p[kTerms];
+            for (int k = 0; k < Order; k++) {
+                x[k] = state_[k][i];
+            }
+            for (int t = 0; t < kTerms; t++) {
+                p[t] = covariance_[t][i];
+            }
+            
+            MotionKernel<Order>::predict_state(steps, x);
+            MotionKernel<Order>::predict_covariance(steps, noise, p);
+            
+            // Row 0 of the predicted P is P(0, k) = p[k]
+            double row[Order];
+            for (int k = 0; k < Order; k++) {
+                row[k] = p[k];
+            }
+            bool valid = (!mask || channel_valid(mask, i)) && (!weights || weights[i] > 0.0);
+            double r = weights && valid ? measurement_noise_ / weights[i] : measurement_noise_;
+            double inv_innovation = 1.0 / (row[0] + r);
+            double innovation = measurements[i] - x[0];
+            double posterior = row[0] * r * inv_innovation;
+            if (!valid) {
+                inv_innovation = 0.0;
+                innovation = 0.0;
+                posterior = row[0];
+            }
+            
+            for (int k = 0; k < Order; k++) {
+                double gain = row[k] * inv_innovation;
+                for (int j = k; j < Order; j++) {
+                    p[term(k, j)] -= gain * row[j];
+                }
+                state_[k][i] = x[k] + gain * innovation;
+                gain_[k][i] = gain;
+            }
+            p[0] = posterior;
+            
+            for (int t = 0; t < kTerms; t++) {
+                settled = settled && has_settled(covariance_[t][i], p[t]);
+                covariance_[t][i] = p[t];
+            }
+            estimated_state_[i] = state_[0][i];
+        }
+        steady_state_ = settled && steps == 1.0 && !mask && !weights;
+        
+        return estimated_state_.data();
+    }
+    
+    int dimensions_;
+    double process_noise_;
+    double measurement_noise_;
+    
+    std::array<PoolArray<double>, Order> state_;       // x, one array per derivative
+    std::array<PoolArray<double>, kTerms> covariance_; // Upper triangle of P
+    std::array<PoolArray<double>, Order> gain_;        // K from the last update
+    
+    bool steady_state_;  // Gains frozen, covariances no longer propagated
+    
+    PoolArray<double> estimated_state_;  // Output buffer (positions)
+    PoolArray<double> prediction_;       // predict() output buffer
+};
+
+// One update of the scalar recursion DiagonalKalmanFilter runs on every
+// channel when F = H = I: advances P, sets the gain, and returns whether P
+// has settled. Written exactly like DiagonalKalmanFilter::step with f = 1,
+// so it rounds the same way.
+inline bool shared_gain_step(double process_noise, double measurement_noise, double& variance,
+                             double& gain) {
+    double predicted_variance = variance + process_noise;
+    double inv_innovation = 1.0 / (predicted_variance + measurement_noise);
+    double next = predicted_variance * measurement_noise * inv_innovation;
+    gain = predicted_variance * inv_innovation;
+    bool settled = has_settled(variance, next);
+    variance = next;
+    return settled;
+}
+
+// With F = H = I and fixed scalar Q and R, the covariance and gain of a
+// filter depend only on how many updates it has seen, never on the
+// measurements, and every channel follows the same scalar recursion.
+// Filters created with identical noise parameters can therefore share one
+// gain trajectory, computed once and extended lazily until it settles.
+class SharedGainTrack {
+public:
+    SharedGainTrack(double process_noise, double measurement_noise)
+        : process_noise_(process_noise),
+          measurement_noise_(measurement_noise),
+          ref_count_(0),
+          variance_(1.0),  // Initial P, as in DiagonalKalmanFilter
+          converged_(false),
+          complete_(false)
+    {
+        gains_.reserve(kInitialCapacity);
+    }
+    
+    // Most entries the table holds (32 KiB). P settles within a few hundred
+    // updates for the usual noise ratios; with q = 0, or q tiny against r,
+    // it keeps shrinking for millions, and the table stops here unsettled.
+    static const int kMaxSteps = 4096;
+    
+    // Gain to apply on the (step + 1)-th update, for step < kMaxSteps or
+    // any step once converged(). Filters on other threads may share the
+    // track, so the table grows under a lock; once complete it never
+    // changes again and is read without one.
+    double gain(int step) {
+        if (!complete_.load(std::memory_order_acquire)) {
+            std::lock_guard<RegistryMutex> lock(mutex_);
+            while (step >= int(gains_.size()) && !complete_.load(std::memory_order_relaxed)) {
+                extend();
+            }
+            return step < int(gains_.size()) ? gains_[step] : gains_.back();
+        }
+        return step < int(gains_.size()) ? gains_[step] : gains_.back();
+    }
+    
+    // Whether P settled, so every step past the table reuses its last gain.
+    // Only meaningful once a step >= kMaxSteps - 1 has been requested.
+    bool converged() const { return converged_; }
+    
+    // P after the last entry of a full, unsettled table, where its filters
+    // carry on the recursion themselves
+    double final_variance() const { return variance_; }
+    
+    double process_noise() const { return process_noise_; }
+    double measurement_noise() const { return measurement_noise_; }
+    
+    void retain() { ref_count_++; }
+    bool release() { return --ref_count_ == 0; }
+    
+private:
+    // The table grows geometrically from here, only until P settles
+    static const int kInitialCapacity = 64;
+    
+    // Once P settles DiagonalKalmanFilter freezes its gain, so later steps
+    // reuse the last entry, exactly like kf_create
+    void extend() {
+        double gain;
+        bool settled = shared_gain_step(process_noise_, measurement_noise_, variance_, gain);
+        gains_.push_back(gain);
+        converged_ = settled;
+        complete_.store(settled || int(gains_.size()) >= kMaxSteps, std::memory_order_release);
+    }
+    
+    double process_noise_;
+    double measurement_noise_;
+    int ref_count_;  // Guarded by g_gain_tracks_mutex
+    double variance_;
+    bool converged_;               // Written before complete_ is set
+    std::atomic<bool> complete_;   // Settled or full: the table is final
+    std::vector<double> gains_;
+    RegistryMutex mutex_;  // Held while the table grows
+};
+
+// Registry of gain tracks, keyed by the bit patterns of q and r so that
+// every value, NaN included, has a well-defined key
+typedef std::pair<uint64_t, uint64_t> GainTrackKey;
+static std::map<GainTrackKey, SharedGainTrack*> g_gain_tracks;
+static RegistryMutex g_gain_tracks_mutex;
+
+static GainTrackKey gain_track_key(double process_noise, double measurement_noise) {
+    GainTrackKey key;
+    std::memcpy(&key.first, &process_noise, sizeof(process_noise));
+    std::memcpy(&key.second, &measurement_noise, sizeof(measurement_noise));
+    return key;
+}
+
+static SharedGainTrack* acquire_gain_track(double process_noise, double measurement_noise) {
+    std::lock_guard<RegistryMutex> lock(g_gain_tracks_mutex);
+    SharedGainTrack*& track = g_gain_tracks[gain_track_key(process_noise, measurement_noise)];
+    if (!track) {
+        track = new SharedGainTrack(process_noise, measurement_noise);
+    }
+    
+    track->retain();
+    return track;
+}
+
+static void release_gain_track(SharedGainTrack* track) {
+    std::lock_guard<RegistryMutex> lock(g_gain_tracks_mutex);
+    if (!track->release()) {
+        return;
+    }
+    
+    g_gain_tracks.erase(gain_track_key(track->process_noise(), track->measurement_noise()));
+    delete track;
+}
+
+// Filter-bank member: owns only O(N) buffers (state, I/O, prediction) and
+// a step counter, and reads the gain from the shared track. Past the end of
+// a track that never settled it runs the same scalar recursion on its own
+// P. Results match a kf_create filter with the same parameters. Its arrays
+// share the filter's pool block.
+class SharedGainKalmanFilter : public KalmanFilterBase {
+public:
+    static SharedGainKalmanFilter* create(int dimensions, double process_noise, double measurement_noise) {
+        PoolExtra arrays = {3 * PoolArray<double>::bytes(dimensions)};
+        return new (arrays) SharedGainKalmanFilter(dimensions, process_noise, measurement_noise);
+    }
+    
+    ~SharedGainKalmanFilter() override {
+        release_gain_track(track_);
+    }
+    
+    int dimensions() const override { return dimensions_; }
+    
+    // The shared track already stops propagating once converged; resetting
+    // just moves this filter back to the start of the trajectory
+    bool reset_gain() override {
+        step_ = 0;
+        return true;
+    }
+    
+    // x = x + k * (z - x), with k shared by every channel and filter
+    const double* update(const double* measurements, int count) override {
+        if (count != dimensions_) {
+            return nullptr;  // Measurement dimension mismatch
+        }
+        
+        // The count stops at kMaxSteps instead of running on towards
+        // overflow; from there on the gain is the track's last one or,
+        // if the track never settled, this filter's own
+        double gain;
+        if (step_ < SharedGainTrack::kMaxSteps) {
+            gain = track_->gain(step_);
+            step_++;
+            if (step_ == SharedGainTrack::kMaxSteps) {
+                variance_ = track_->final_variance();
+                gain_ = gain;
+                steady_state_ = false;
+            }
+        } else if (track_->converged()) {
+            gain = track_->gain(step_);
+        } else {
+            if (!steady_state_) {
+                steady_state_ = shared_gain_step(track_->process_noise(), track_->measurement_noise(),
+                                                 variance_, gain_);
+            }
+            gain = gain_;
+        }
+        for (int i = 0; i < dimensions_; i++) {
+            state_[i] = state_[i] + gain * (measurements[i] - state_[i]);
+        }
+        
+        // The state doubles as the output buffer
+        return state_.data();
+    }
+    
+    // F = I, so the state is its own extrapolation. It is copied, so the
+    // caller cannot write through the result into the state.
+    const double* predict(double steps) override {
+        (void)steps;
+        std::copy(state_.begin(), state_.end(), prediction_.begin());
+        return prediction_.data();
+    }
+    
+    // The state is the output buffer, so in-place updates need their own
+    // buffer that the caller may overwrite
+    void* io_buffer() override { return io_.data(); }
+    
+    bool update_in_place() override {
+        update(io_.data(), dimensions_);
+        std::copy(state_.begin(), state_.end(), io_.begin());
+        return true;
+    }
+    
+    // The covariance lives in the shared track; the step count selects it.
+    // The filter's own P and gain only matter past the end of the track.
+    size_t state_bytes() const override {
+        return size_t(dimensions_) * sizeof(double) + sizeof(int) + 2 * sizeof(double) + sizeof(uint8_t);
+    }
+    
+    void save_state(unsigned char* out) const override {
+        StateWriter writer(out);
+        writer.write(state_.data(), state_.size());
+        writer.write(&step_, 1);
+        writer.write(&variance_, 1);
+        writer.write(&gain_, 1);
+        writer.write_flag(steady_state_);
+    }
+    
+    bool load_state(const unsigned char* in) override {
+        StateReader reader(in);
+        reader.read(state_.data(), state_.size());
+        reader.read(&step_, 1);
+        reader.read(&variance_, 1);
+        reader.read(&gain_, 1);
+        if (!reader.read_flag(steady_state_)) {
+            return false;
+        }
+        if (step_ < 0 || step_ > SharedGainTrack::kMaxSteps) {
+            step_ = SharedGainTrack::kMaxSteps;  // Corrupt count: past the track
+        }
+        return true;
+    }
+    
+    // q and r select the track, which recomputes the same gains
+    SnapshotKind snapshot_kind() const override { return kSnapshotShared; }
+    
+    size_t model_bytes() const override { return 2 * sizeof(double); }
+    
+    void save_model(unsigned char* out) const override {
+        double noise[2] = {track_->process_noise(), track_->measurement_noise()};
+        StateWriter(out).write(noise, 2);
+    }
+    
+private:
+    SharedGainKalmanFilter(int dimensions, double process_noise, double measurement_noise)
+        : dimensions_(dimensions),
+          step_(0),
+          variance_(1.0),
+          gain_(0.0),
+          steady_state_(false),
+          track_(acquire_gain_track(process_noise, measurement_noise)),
+          state_(pool_trailing_storage(this, sizeof(*this)), dimensions, 0.0),
+          io_(pool_trailing_storage(this, sizeof(*this)) + PoolArray<double>::bytes(dimensions), dimensions, 0.0),
+          prediction_(pool_trailing_storage(this, sizeof(*this)) + 2 * PoolArray<double>::bytes(dimensions),
+                      dimensions, 0.0)
+    {
+    }
+    
+    int dimensions_;
+    int step_;
+    double variance_;     // Own P and gain, past the end of an unsettled track
+    double gain_;
+    bool steady_state_;   // Own P settled, gain_ frozen
+    SharedGainTrack* track_;
+    PoolArray<double> state_;
+    PoolArray<double> io_;          // Measurements in, estimates out
+    PoolArray<double> prediction_;  // predict() output buffer
+};
+
+// Exclusive access to a registered filter for the length of one API call,
+// or empty if the handle is invalid. While it is held no other thread can
+// update or destroy the filter; other filters are unaffected.
+class LockedFilter {
+public:
+    LockedFilter() : filter_(nullptr), mutex_(nullptr) {}
+    LockedFilter(KalmanFilterBase* filter, RegistryMutex* mutex) : filter_(filter), mutex_(mutex) {}
+    LockedFilter(LockedFilter&& other) : filter_(other.filter_), mutex_(other.mutex_) {
+        other.filter_ = nullptr;
+        other.mutex_ = nullptr;
+    }
+    ~LockedFilter() {
+        if (mutex_) {
+            mutex_->unlock();
+        }
+    }
+    
+    LockedFilter(const LockedFilter&) = delete;
+    LockedFilter& operator=(const LockedFilter&) = delete;
+    
+    KalmanFilterBase* get() const { return filter_; }
+    KalmanFilterBase* operator->() const { return filter_; }
+    explicit operator bool() const { return filter_ != nullptr; }
+    
+private:
+    KalmanFilterBase* filter_;
+    RegistryMutex* mutex_;
+};
+
+// Global registry of Kalman filters
+//
+// Generational slot map: a handle packs a slot index (low bits) and the
+// generation of that slot (high bits); every destroy bumps the slot's
+// generation, so a stale handle no longer matches and is rejected.
+//
+// It is safe to use from several threads. Slots live in fixed-size chunks
+// that are allocated on demand and never move, so a lookup needs no global
+// lock: it finds the slot with two loads and then takes only that slot's
+// lock, which an update holds while it runs. Free slots are kept on
+// per-thread-sharded free lists, so create and destroy on one thread do
+// not wait for another thread's creates or for updates of other filters.
+// Slots are cache-line aligned so neighbouring filters updated on
+// different cores do not share a line.
+class FilterRegistry {
+public:
+    FilterRegistry() : next_index_(0), next_shard_(0) {
+        for (std::atomic<Slot*>& chunk : chunks_) {
+            chunk.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+    
+    ~FilterRegistry() {
+        for (std::atomic<Slot*>& chunk : chunks_) {
+            delete[] chunk.load(std::memory_order_relaxed);
+        }
+    }
+    
+    int insert(KalmanFilterBase* filter) {
+        uint32_t index = pop_free(kQuarantineSlots);
+        if (index == kNoSlot && next_index_.load(std::memory_order_relaxed) <= kIndexMask) {
+            index = next_index_.fetch_add(1, std::memory_order_relaxed);
+            if (index <= kIndexMask) {
+                allocate_chunk(index >> kChunkBits);
+            } else {
+                index = kNoSlot;  // Another thread took the last fresh slot
+            }
+        }
+        if (index == kNoSlot) {
+            // Out of fresh slots: reuse quarantined ones rather than fail
+            index = pop_free(0);
+            if (index == kNoSlot) {
+                return 0;  // Registry full
+            }
+        }
+        
+        Slot& slot = *find_slot(index);
+        std::lock_guard<RegistryMutex> lock(slot.mutex);
+        slot.filter = filter;
+        return int((slot.generation << kIndexBits) | index);
+    }
+    
+    LockedFilter lock(int handle) {
+        Slot* slot = handle > 0 ? find_slot(uint32_t(handle) & kIndexMask) : nullptr;
+        if (!slot) {
+            return LockedFilter();
+        }
+        
+        slot->mutex.lock();
+        if (!slot->filter || slot->generation != (uint32_t(handle) >> kIndexBits)) {
+            slot->mutex.unlock();
+            return LockedFilter();
+        }
+        return LockedFilter(slot->filter, &slot->mutex);
+    }
+    
+    // Detach the filter behind a handle, returning it for destruction.
+    // Waits for a call in progress on the same handle to finish.
+    KalmanFilterBase* remove(int handle) {
+        uint32_t index = uint32_t(handle) & kIndexMask;
+        Slot* slot = handle > 0 ? find_slot(index) : nullptr;
+        if (!slot) {
+            return nullptr;
+        }
+        
+        KalmanFilterBase* filter;
+        {
+            std::lock_guard<RegistryMutex> lock(slot->mutex);
+            if (!slot->filter || slot->generation != (uint32_t(handle) >> kIndexBits)) {
+                return nullptr;
+            }
+            filter = slot->filter;
+            slot->filter = nullptr;
+            // Skip generation 0 on wrap-around so handles stay non-zero
+            slot->generation = slot->generation == kMaxGeneration ? 1 : slot->generation + 1;
+        }
+        
+        // Queue at the tail, so the slot is reused last
+        Shard& shard = home_shard();
+        std::lock_guard<RegistryMutex> lock(shard.mutex);
+        slot->next_free = kNoSlot;
+        if (shard.free_tail == kNoSlot) {
+            shard.free_head = index;
+        } else {
+            find_slot(shard.free_tail)->next_free = index;
+        }
+        shard.free_tail = index;
+        shard.free_count++;
+        return filter;
+    }
+    
+    // Call visit(handle, filter) for every live filter, in slot order, with
+    // that filter locked
+    template <typename Visit>
+    void for_each(Visit visit) {
+        uint32_t count = std::min(next_index_.load(std::memory_order_relaxed), kIndexMask + 1);
+        for (uint32_t index = 0; index < count; index++) {
+            Slot* slot = find_slot(index);
+            if (!slot) {
+                continue;  // Chunk still being allocated by another thread
+            }
+            std::lock_guard<RegistryMutex> lock(slot->mutex);
+            if (slot->filter) {
+                visit(int((slot->generation << kIndexBits) | index), slot->filter);
+            }
+        }
+    }
+    
+private:
+    // 16 index bits (65536 live filters) and 15 generation bits keep
+    // handles positive ints. A stale handle only resolves again once its
+    // slot has wrapped through all 32767 generations; with FIFO reuse and
+    // the quarantine below that takes tens of millions of create/destroy
+    // cycles even when a single filter churns.
+    static const uint32_t kIndexBits = 16;
+    static const uint32_t kIndexMask = (1u << kIndexBits) - 1;
+    static const uint32_t kMaxGeneration = (1u << (31 - kIndexBits)) - 1;
+    static const uint32_t kNoSlot = 0xffffffffu;
+    
+    // 64 chunks of 1024 slots cover every index
+    static const uint32_t kChunkBits = 10;
+    static const uint32_t kChunkSize = 1u << kChunkBits;
+    static const uint32_t kChunks = (kIndexMask + 1) >> kChunkBits;
+    
+    static const uint32_t kShards = 16;
+    
+    // Freed slots wait in their shard's queue until this many newer ones
+    // are behind them, so no slot is reused more than once per 1024 destroys
+    static const uint32_t kQuarantineSlots = 1024;
+    
+    struct alignas(64) Slot {
+        Slot() : filter(nullptr), generation(1), next_free(kNoSlot) {}
+        
+        RegistryMutex mutex;         // Guards filter and generation
+        KalmanFilterBase* filter;
+        uint32_t generation;
+        uint32_t next_free;          // Guarded by the free list's shard
+    };
+    
+    // FIFO queue of free slots, linked through Slot::next_free
+    struct alignas(64) Shard {
+        Shard() : free_head(kNoSlot), free_tail(kNoSlot), free_count(0) {}
+        
+        RegistryMutex mutex;
+        uint32_t free_head;
+        uint32_t free_tail;
+        uint32_t free_count;
+    };
+    
+    Slot* find_slot(uint32_t index) const {
+        Slot* chunk = chunks_[index >> kChunkBits].load(std::memory_order_acquire);
+        return chunk ? chunk + (index & (kChunkSize - 1)) : nullptr;
+    }
+    
+    void allocate_chunk(uint32_t chunk) {
+        if (chunks_[chunk].load(std::memory_order_acquire)) {
+            return;
+        }
+        
+        std::lock_guard<RegistryMutex> lock(grow_mutex_);
+        if (!chunks_[chunk].load(std::memory_order_relaxed)) {
+            chunks_[chunk].store(new Slot[kChunkSize], std::memory_order_release);
+        }
+    }
+    
+    // Each thread frees into and allocates from its own shard. When that
+    // one has nothing to spare it takes from the others, skipping any that
+    // are busy, so slots freed on one thread are reused by creates on
+    // another.
+    Shard& home_shard() {
+        thread_local uint32_t home = next_shard_.fetch_add(1, std::memory_order_relaxed) % kShards;
+        return shards_[home];
+    }
+    
+    // Oldest free slot of a shard holding more than `keep` of them
+    uint32_t pop_free(uint32_t keep) {
+        uint32_t home = uint32_t(&home_shard() - shards_);
+        for (uint32_t i = 0; i < kShards; i++) {
+            Shard& shard = shards_[(home + i) % kShards];
+            if (i == 0) {
+                shard.mutex.lock();
+            } else if (!shard.mutex.try_lock()) {
+                continue;
+            }
+            
+            uint32_t index = kNoSlot;
+            if (shard.free_count > keep) {
+                index = shard.free_head;
+                shard.free_head = find_slot(index)->next_free;
+                if (shard.free_head == kNoSlot) {
+                    shard.free_tail = kNoSlot;
+                }
+                shard.free_count--;
+            }
+            shard.mutex.unlock();
+            if (index != kNoSlot) {
+                return index;
+            }
+        }
+        return kNoSlot;
+    }
+    
+    std::atomic<Slot*> chunks_[kChunks];
+    std::atomic<uint32_t> next_index_;  // Slots handed out so far
+    std::atomic<uint32_t> next_shard_;  // Round-robin home shard assignment
+    RegistryMutex grow_mutex_;
+    Shard shards_[kShards];
+};
+
+static FilterRegistry g_filters;
+
+static int register_filter(KalmanFilterBase* filter) {
+    int handle = g_filters.insert(filter);
+    if (!handle) {
+        delete filter;
+    }
+    return handle;
+}
+
+// True when every off-diagonal entry of a row-major size x size matrix is zero
+static bool is_diagonal(const double* matrix, int size) {
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            if (i != j && matrix[i * size + j] != 0.0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <int N>
+static KalmanFilterBase* create_dense_filter(int dimensions, const double* transition,
+                                             const double* process_noise,
+                                             const double* measurement_noise) {
+    KalmanFilter<N>* filter = KalmanFilter<N>::create(dimensions, dimensions);
+    filter->set_model(transition, process_noise, measurement_noise);
+    return filter;
+}
+
+// Square dense filters come back as the instantiation kf_create_model
+// picks for their size, others as the fully dynamic one. The model is
+// loaded by the caller.
+static KalmanFilterBase* restore_dense_filter(int state_dimensions, int measurement_dimensions) {
+    if (state_dimensions != measurement_dimensions) {
+        return KalmanFilter<kDynamic, kDynamic>::create(state_dimensions, measurement_dimensions);
+    }
+    
+    switch (state_dimensions) {
+        case 1:  return KalmanFilter<1>::create(1, 1);
+        case 2:  return KalmanFilter<2>::create(2, 2);
+        case 3:  return KalmanFilter<3>::create(3, 3);
+        case 63: return KalmanFilter<63>::create(63, 63);
+        default: return KalmanFilter<kDynamic>::create(state_dimensions, state_dimensions);
+    }
+}
+
+// Build a filter for an explicit model. Diagonal models get the O(N)
+// per-channel filter; cross-coupled ones use the dense filter, picking a
+// fixed-size instantiation for the dimensions we use in practice
+// (1 for demos, 2/3 per landmark, 63 per hand).
+static KalmanFilterBase* create_model_filter(int dimensions, const double* transition,
+                                             const double* process_noise,
+                                             const double* measurement_noise) {
+    if (is_diagonal(transition, dimensions) && is_diagonal(process_noise, dimensions) &&
+        is_diagonal(measurement_noise, dimensions)) {
+        DiagonalKalmanFilter<>* filter = DiagonalKalmanFilter<>::create(dimensions, 0.0, 0.0);
+        filter->set_model(transition, process_noise, measurement_noise);
+        return filter;
+    }
+    
+    switch (dimensions) {
+        case 1:  return create_dense_filter<1>(dimensions, transition, process_noise, measurement_noise);
+        case 2:  return create_dense_filter<2>(dimensions, transition, process_noise, measurement_noise);
+        case 3:  return create_dense_filter<3>(dimensions, transition, process_noise, measurement_noise);
+        case 63: return create_dense_filter<63>(dimensions, transition, process_noise, measurement_noise);
+        default: return create_dense_filter<kDynamic>(dimensions, transition, process_noise, measurement_noise);
+    }
+}
+
+// Build a factored filter, or nothing if Q or R is not a valid covariance
+template <typename T>
+static KalmanFilterBase* create_ud_filter(int state_dimensions, int measurement_dimensions,
+                                          const double* transition, const double* measurement_matrix,
+                                          const double* process_noise, const double* measurement_noise) {
+    UDKalmanFilter<T>* filter = new UDKalmanFilter<T>(state_dimensions, measurement_dimensions);
+    if (!filter->set_model(transition, measurement_matrix, process_noise, measurement_noise)) {
+        delete filter;
+        return nullptr;
+    }
+    return filter;
+}
+
+// Apply an in-order timestamped update and record it in the history ring
+static const double* update_at(KalmanFilterBase* filter, const double* measurements, int count,
+                               double timestamp) {
+    FilterClock& clock = filter->clock;
+    double steps = 1.0;  // The first timestamped update counts as one frame
+    if (clock.started) {
+        steps = std::min((timestamp - clock.last_timestamp) / clock.frame_interval, kMaxTimeSteps);
+        if (std::abs(steps - 1.0) < kUnitStepTolerance) {
+            steps = 1.0;
+        }
+    }
+    
+    if (filter->history && count == filter->dimensions()) {
+        filter->history->stage(measurements);
+    }
+    
+    const double* state = filter->update_steps(measurements, count, steps);
+    if (state) {
+        clock.last_timestamp = timestamp;
+        clock.started = true;
+        if (filter->history) {
+            filter->save_state(filter->history->push(timestamp));
+        }
+    }
+    return state;
+}
+
+// Apply a measurement older than the last update: rewind to the newest
+// recorded state not after it, apply it, then re-apply the later ones
+static const double* update_late(KalmanFilterBase* filter, const double* measurements, int count,
+                                 double timestamp) {
+    StateHistory* history = filter->history;
+    if (!history || count != filter->dimensions()) {
+        return nullptr;  // No history or dimension mismatch
+    }
+    
+    int keep = history->count_until(timestamp);
+    if (keep == 0) {
+        return nullptr;  // Older than anything we can rewind to
+    }
+    
+    history->detach_after(keep);
+    filter->load_state(history->state(keep - 1));
+    filter->clock.last_timestamp = history->timestamp(keep - 1);
+    
+    const double* state = update_at(filter, measurements, count, timestamp);
+    for (int i = 0; i < history->replay_count(); i++) {
+        state = update_at(filter, history->replay_measurements(i), count, history->replay_timestamp(i));
+    }
+    return state;
+}
+
+// Fixed-layout header of a kf_snapshot blob, followed by the model
+// (save_model) and the state (save_state). Values are in the machine's byte
+// order, little-endian under WASM.
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t kind;                    // SnapshotKind
+    int32_t state_dimensions;
+    int32_t measurement_dimensions;
+    uint32_t model_bytes;
+    uint32_t state_bytes;
+    uint32_t clock_started;           // FilterClock, so kf_update_at carries on
+    double frame_interval;
+    double last_timestamp;
+};
+
+// kf_snapshot_all: a set header, then per filter its handle, the blob size
+// and a kf_snapshot blob
+struct SnapshotSetHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct SnapshotRecord {
+    int32_t handle;
+    uint32_t bytes;
+};
+
+static_assert(sizeof(SnapshotHeader) == 48, "snapshot header layout changed");
+static_assert(sizeof(SnapshotSetHeader) == 16, "snapshot set header layout changed");
+static_assert(sizeof(SnapshotRecord) == 8, "snapshot record layout changed");
+
+static const uint32_t kSnapshotMagic = 0x4e53464b;     // "KFSN"
+static const uint32_t kSnapshotSetMagic = 0x4153464b;  // "KFSA"
+static const uint32_t kSnapshotVersion = 1;
+
+// Bytes of filter's snapshot, 0 if it cannot be snapshotted
+static size_t snapshot_bytes(const KalmanFilterBase* filter) {
+    if (filter->snapshot_kind() == kSnapshotNone) {
+        return 0;
+    }
+    return sizeof(SnapshotHeader) + filter->model_bytes() + filter->state_bytes();
+}
+
+// Write snapshot_bytes(filter) bytes straight into out
+static void write_snapshot(const KalmanFilterBase* filter, unsigned char* out) {
+    SnapshotHeader header;
+    header.magic = kSnapshotMagic;
+    header.version = kSnapshotVersion;
+    header.kind = filter->snapshot_kind();
+    header.state_dimensions = filter->state_dimensions();
+    header.measurement_dimensions = filter->dimensions();
+    header.model_bytes = uint32_t(filter->model_bytes());
+    header.state_bytes = uint32_t(filter->state_bytes());
+    header.clock_started = filter->clock.started ? 1u : 0u;
+    header.frame_interval = filter->clock.frame_interval;
+    header.last_timestamp = filter->clock.last_timestamp;
+    std::memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    filter->save_model(out);
+    filter->save_state(out + header.model_bytes);
+}
+
+// An empty filter of the given kind, or nullptr. Models that are just
+// the two noise values are taken here; read_snapshot loads the others once
+// it has checked that the filter's sizes match the blob.
+static KalmanFilterBase* create_snapshot_filter(const SnapshotHeader& header, const unsigned char* model) {
+    int n = header.state_dimensions;
+    int m = header.measurement_dimensions;
+    double noise[2];
+    bool scalar_model = header.model_bytes == sizeof(noise);
+    if (scalar_model) {
+        std::memcpy(noise, model, sizeof(noise));
+    }
+    
+    switch (header.kind) {
+        case kSnapshotDiagonal:
+            return DiagonalKalmanFilter<double>::create(n, 0.0, 0.0);
+        case kSnapshotDiagonalF32:
+            return DiagonalKalmanFilter<float>::create(n, 0.0, 0.0);
+        case kSnapshotConstantVelocity:
+            return scalar_model ? MotionModelFilter<2>::create(n, noise[0], noise[1]) : nullptr;
+        case kSnapshotConstantAcceleration:
+            return scalar_model ? MotionModelFilter<3>::create(n, noise[0], noise[1]) : nullptr;
+        case kSnapshotShared:
+            return scalar_model ? SharedGainKalmanFilter::create(n, noise[0], noise[1]) : nullptr;
+        case kSnapshotDense:
+            return restore_dense_filter(n, m);
+        case kSnapshotUD:
+            return new UDKalmanFilter<double>(n, m);
+        case kSnapshotUDF32:
+            return new UDKalmanFilter<float>(n, m);
+        default:
+            return nullptr;  // Unknown kind
+    }
+}
+
+// Rebuild a filter from a blob of `size` bytes, or nullptr if the blob is
+// truncated, from another format version or inconsistent with its kind
+static KalmanFilterBase* read_snapshot(const unsigned char* in, size_t size) {
+    SnapshotHeader header;
+    if (size < sizeof(header)) {
+        return nullptr;
+    }
+    std::memcpy(&header, in, sizeof(header));
+    
+    size_t n = size_t(header.state_dimensions);
+    size_t m = size_t(header.measurement_dimensions);
+    if (header.magic != kSnapshotMagic || header.version != kSnapshotVersion ||
+        header.state_dimensions <= 0 || header.measurement_dimensions <= 0 ||
+        !(header.frame_interval > 0.0) ||
+        size - sizeof(header) < size_t(header.model_bytes) + header.state_bytes) {
+        return nullptr;
+    }
+    // Filters store at least one value per channel, and the dense ones all
+    // of their n x n, m x n and m x m matrices, in the blob. Checking that
+    // keeps a corrupt header from asking for a huge allocation.
+    bool dense = header.kind == kSnapshotDense || header.kind == kSnapshotUD || header.kind == kSnapshotUDF32;
+    if (n > size || m > size || (dense && (n * n > size || m * n > size || m * m > size))) {
+        return nullptr;
+    }
+    
+    const unsigned char* model = in + sizeof(header);
+    KalmanFilterBase* filter = create_snapshot_filter(header, model);
+    if (!filter) {
+        return nullptr;
+    }
+    if (filter->model_bytes() != header.model_bytes || filter->state_bytes() != header.state_bytes ||
+        size_t(filter->state_dimensions()) != n || size_t(filter->dimensions()) != m) {
+        delete filter;
+        return nullptr;
+    }
+    
+    // Only now is it known that both reads stay inside the blob
+    if (!filter->load_model(model) || !filter->load_state(model + header.model_bytes)) {
+        delete filter;
+        return nullptr;  // A flag byte other than 0 or 1
+    }
+    filter->clock.frame_interval = header.frame_interval;
+    filter->clock.last_timestamp = header.last_timestamp;
+    filter->clock.started = header.clock_started != 0;
+    return filter;
+}
+
+// C-style API implementation exposed to WebAssembly
+extern "C" {
+
+EMSCRIPTEN_KEEPALIVE
+int kf_create(int dimensions, double process_noise, double measurement_noise) {
+    if (dimensions <= 0) {
+        return 0;  // Invalid dimensions
+    }
+    
+    // F = H = I with scalar Q and R is diagonal, so the O(N) filter applies
+    return register_filter(DiagonalKalmanFilter<>::create(dimensions, process_noise, measurement_noise));
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_create_f32(int dimensions, double process_noise, double measurement_noise) {
+    if (dimensions <= 0) {
+        return 0;  // Invalid dimensions
+    }
+    
+    return register_filter(DiagonalKalmanFilter<float>::create(dimensions, process_noise, measurement_noise));
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_create_steady(int dimensions, double process_noise, double measurement_noise) {
+    if (dimensions <= 0 || process_noise < 0.0 || measurement_noise <= 0.0) {
+        return 0;  // Invalid arguments
+    }
+    
+    DiagonalKalmanFilter<>* filter = DiagonalKalmanFilter<>::create(dimensions, process_noise, measurement_noise);
+    filter->precompute_steady_state();
+    return register_filter(filter);
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_create_shared(int dimensions, double process_noise, double measurement_noise) {
+    if (dimensions <= 0) {
+        return 0;  // Invalid dimensions
+    }
+    
+    return register_filter(SharedGainKalmanFilter::create(dimensions, process_noise, measurement_noise));
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_create_motion(int dimensions, int model, double process_noise, double measurement_noise) {
+    if (dimensions <= 0) {
+        return 0;  // Invalid dimensions
+    }
+    
+    switch (model) {
+        case KF_MODEL_RANDOM_WALK:
+            return kf_create(dimensions, process_noise, measurement_noise);
+        case KF_MODEL_CONSTANT_VELOCITY:
+            return register_filter(MotionModelFilter<2>::create(dimensions, process_noise, measurement_noise));
+        case KF_MODEL_CONSTANT_ACCELERATION:
+            return register_filter(MotionModelFilter<3>::create(dimensions, process_noise, measurement_noise));
+        default:
+            return 0;  // Unknown model
+    }
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_create_model(int dimensions, const double* transition, const double* process_noise,
+                    const double* measurement_noise) {
+    if (dimensions <= 0 || !transition || !process_noise || !measurement_noise) {
+        return 0;  // Invalid arguments
+    }
+    
+    return register_filter(create_model_filter(dimensions, transition, process_noise, measurement_noise));
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_create_general(int state_dimensions, int measurement_dimensions, const double* transition,
+                      const double* measurement_matrix, const double* process_noise,
+                      const double* measurement_noise) {
+    if (state_dimensions <= 0 || measurement_dimensions <= 0 || !transition ||
+        !measurement_matrix || !process_noise || !measurement_noise) {
+        return 0;  // Invalid arguments
+    }
+    
+    KalmanFilter<kDynamic, kDynamic>* filter =
+        KalmanFilter<kDynamic, kDynamic>::create(state_dimensions, measurement_dimensions);
+    filter->set_model(transition, measurement_matrix, process_noise, measurement_noise);
+    return register_filter(filter);
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_create_ud(int state_dimensions, int measurement_dimensions, const double* transition,
+                 const double* measurement_matrix, const double* process_noise,
+                 const double* measurement_noise) {
+    if (state_dimensions <= 0 || measurement_dimensions <= 0 || !transition ||
+        !measurement_matrix || !process_noise || !measurement_noise) {
+        return 0;  // Invalid arguments
+    }
+    
+    KalmanFilterBase* filter = create_ud_filter<double>(state_dimensions, measurement_dimensions, transition,
+                                                        measurement_matrix, process_noise, measurement_noise);
+    return filter ? register_filter(filter) : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_create_ud_f32(int state_dimensions, int measurement_dimensions, const double* transition,
+                     const double* measurement_matrix, const double* process_noise,
+                     const double* measurement_noise) {
+    if (state_dimensions <= 0 || measurement_dimensions <= 0 || !transition ||
+        !measurement_matrix || !process_noise || !measurement_noise) {
+        return 0;  // Invalid arguments
+    }
+    
+    KalmanFilterBase* filter = create_ud_filter<float>(state_dimensions, measurement_dimensions, transition,
+                                                       measurement_matrix, process_noise, measurement_noise);
+    return filter ? register_filter(filter) : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+double* kf_update(int handle, const double* measurements, int count) {
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter) {
+        return nullptr;  // Invalid handle
+    }
+    
+    return const_cast<double*>(filter->update(measurements, count));
+}
+
+EMSCRIPTEN_KEEPALIVE
+float* kf_update_f32(int handle, const float* measurements, int count) {
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter) {
+        return nullptr;  // Invalid handle
+    }
+    
+    return const_cast<float*>(filter->update_f32(measurements, count));
+}
+
+EMSCRIPTEN_KEEPALIVE
+double* kf_update_masked(int handle, const double* measurements, int count, const uint32_t* mask) {
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter) {
+        return nullptr;  // Invalid handle
+    }
+    
+    // A full mask takes the regular path, steady-state gain included
+    if (!mask || (count == filter->dimensions() && all_channels_valid(mask, count))) {
+        return const_cast<double*>(filter->update(measurements, count));
+    }
+    return const_cast<double*>(filter->update_masked(measurements, count, mask));
+}
+
+EMSCRIPTEN_KEEPALIVE
+double* kf_update_multi(int handle, const double* measurements, const double* weights, int set_count,
+                        int count) {
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter || !measurements || set_count <= 0 || count != filter->dimensions()) {
+        return nullptr;  // Invalid handle or arguments
+    }
+    
+    // In information form independent measurements of the same state simply
+    // add up: per channel, total weight W = sum(w) and fused z = sum(w * z) / W,
+    // measured with noise R / W. One pass per set, then a single update.
+    thread_local std::vector<double> fused;
+    thread_local std::vector<double> total;
+    fused.assign(count, 0.0);
+    total.assign(count, 0.0);
+    for (int set = 0; set < set_count; set++) {
+        const double* values = measurements + size_t(set) * count;
+        for (int i = 0; i < count; i++) {
+            double weight = weights ? weights[size_t(set) * count + i] : 1.0;
+            if (weight > 0.0) {
+                fused[i] += weight * values[i];
+                total[i] += weight;
+            }
+        }
+    }
+    
+    bool unit = true;
+    for (int i = 0; i < count; i++) {
+        if (total[i] > 0.0) {
+            fused[i] /= total[i];
+        }
+        unit = unit && total[i] == 1.0;
+    }
+    
+    // A single full-weight set is a plain update, steady-state gain included
+    if (unit) {
+        return const_cast<double*>(filter->update(fused.data(), count));
+    }
+    return const_cast<double*>(filter->update_weighted(fused.data(), count, total.data()));
+}
+
+EMSCRIPTEN_KEEPALIVE
+double* kf_update_at(int handle, const double* measurements, int count, double timestamp) {
+    if (!std::isfinite(timestamp)) {
+        return nullptr;  // NaN or infinite time would poison the clock
+    }
+    
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter) {
+        return nullptr;  // Invalid handle
+    }
+    
+    if (filter->clock.started && !(timestamp >= filter->clock.last_timestamp)) {
+        return const_cast<double*>(update_late(filter.get(), measurements, count, timestamp));
+    }
+    return const_cast<double*>(update_at(filter.get(), measurements, count, timestamp));
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_enable_fixed_lag(int handle, int lag) {
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter || lag < 0) {
+        return 0;  // Invalid handle or lag
+    }
+    
+    return filter->enable_fixed_lag(lag) ? 1 : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+double* kf_update_lagged(int handle, const double* measurements, int count) {
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter) {
+        return nullptr;  // Invalid handle
+    }
+    
+    return const_cast<double*>(filter->update_lagged(measurements, count));
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_enable_history(int handle, int capacity) {
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter || capacity < 0) {
+        return 0;  // Invalid handle or capacity
+    }
+    
+    delete filter->history;
+    filter->history = nullptr;
+    if (capacity > 0) {
+        filter->history = new StateHistory(capacity, filter->dimensions(), filter->state_bytes());
+    }
+    return 1;
+}
+
+EMSCRIPTEN_KEEPALIVE
+double* kf_predict(int handle, double dt) {
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter) {
+        return nullptr;  // Invalid handle
+    }
+    
+    double steps = dt / filter->clock.frame_interval;
+    if (!(steps >= 0.0 && steps <= kMaxTimeSteps)) {
+        return nullptr;  // Negative, non-finite or too far ahead
+    }
+    
+    return const_cast<double*>(filter->predict(steps));
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_set_frame_interval(int handle, double seconds) {
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter || !(seconds > 0.0)) {
+        return 0;  // Invalid handle or interval
+    }
+    
+    filter->clock.frame_interval = seconds;
+    return 1;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void* kf_io_buffer(int handle) {
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter) {
+        return nullptr;  // Invalid handle
+    }
+    
+    return filter->io_buffer();
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_io_buffer_size(int handle) {
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter) {
+        return 0;  // Invalid handle
+    }
+    
+    return filter->io_buffer_size();
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_io_buffer_precision(int handle) {
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter) {
+        return 0;  // Invalid handle
+    }
+    
+    return filter->io_value_bytes();
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_update_into(int handle) {
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter) {
+        return 0;  // Invalid handle
+    }
+    
+    return filter->update_in_place() ? 1 : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_update_batch(const int* handles, int filter_count, const double* measurements,
+                    int dimensions, double* out) {
+    if (!handles || !measurements || !out || filter_count <= 0 || dimensions <= 0) {
+        return 0;  // Invalid arguments
+    }
+    
+    // Measurements and results are laid out filter-major: filter f's
+    // channels are the contiguous row [f * dimensions, (f + 1) * dimensions),
+    // so every filter runs its own vectorised per-channel loop over
+    // contiguous input. That beats gathering filters into lanes: their
+    // state lives in separate blocks. Filters are locked one at a time, so
+    // a handle may appear more than once.
+    int updated = 0;
+    for (int f = 0; f < filter_count; f++) {
+        double* row = out + size_t(f) * dimensions;
+        LockedFilter filter = g_filters.lock(handles[f]);
+        const double* state = nullptr;
+        if (filter && filter->dimensions() == dimensions && filter->state_dimensions() == dimensions) {
+            state = filter->update(measurements + size_t(f) * dimensions, dimensions);
+        }
+        if (!state) {
+            // Invalid handle, dimension mismatch or single-precision filter
+            std::fill(row, row + dimensions, std::numeric_limits<double>::quiet_NaN());
+            continue;
+        }
+        std::copy(state, state + dimensions, row);
+        updated++;
+    }
+    
+    return updated;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_set_noise(int handle, double process_noise, double measurement_noise) {
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter || !(process_noise >= 0.0) || !(measurement_noise > 0.0)) {
+        return 0;  // Invalid handle or noise
+    }
+    
+    return filter->set_noise(process_noise, measurement_noise) ? 1 : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_enable_adaptive(int handle, int window) {
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter || window < 0) {
+        return 0;  // Invalid handle or window
+    }
+    
+    return filter->enable_adaptive(window) ? 1 : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_reset_gain(int handle) {
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter) {
+        return 0;  // Invalid handle
+    }
+    
+    return filter->reset_gain() ? 1 : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_snapshot(int handle, void* buffer, int capacity) {
+    LockedFilter filter = g_filters.lock(handle);
+    if (!filter) {
+        return 0;  // Invalid handle
+    }
+    
+    size_t bytes = snapshot_bytes(filter.get());
+    if (bytes > size_t(std::numeric_limits<int>::max())) {
+        return 0;  // Does not fit the return value
+    }
+    if (bytes && buffer && capacity >= int(bytes)) {
+        write_snapshot(filter.get(), static_cast<unsigned char*>(buffer));
+    }
+    return int(bytes);
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_restore(const void* buffer, int size) {
+    if (!buffer || size <= 0) {
+        return 0;  // Invalid arguments
+    }
+    
+    KalmanFilterBase* filter = read_snapshot(static_cast<const unsigned char*>(buffer), size_t(size));
+    return filter ? register_filter(filter) : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_snapshot_all(void* buffer, int capacity) {
+    size_t total = sizeof(SnapshotSetHeader);
+    g_filters.for_each([&](int, KalmanFilterBase* filter) {
+        size_t bytes = snapshot_bytes(filter);
+        total += bytes ? sizeof(SnapshotRecord) + bytes : 0;
+    });
+    if (total > size_t(std::numeric_limits<int>::max())) {
+        return 0;  // Does not fit the return value
+    }
+    if (!buffer || capacity < int(total)) {
+        return int(total);
+    }
+    
+    // Filters created on other threads since the size pass are left out
+    // if they no longer fit
+    unsigned char* out = static_cast<unsigned char*>(buffer);
+    SnapshotSetHeader header = {kSnapshotSetMagic, kSnapshotVersion, 0, 0};
+    size_t offset = sizeof(header);
+    g_filters.for_each([&](int handle, KalmanFilterBase* filter) {
+        size_t bytes = snapshot_bytes(filter);
+        if (!bytes || offset + sizeof(SnapshotRecord) + bytes > size_t(capacity)) {
+            return;  // Skipped, see kf_snapshot
+        }
+        SnapshotRecord record = {handle, uint32_t(bytes)};
+        std::memcpy(out + offset, &record, sizeof(record));
+        write_snapshot(filter, out + offset + sizeof(record));
+        offset += sizeof(record) + bytes;
+        header.count++;
+    });
+    std::memcpy(out, &header, sizeof(header));
+    return int(offset);
+}
+
+EMSCRIPTEN_KEEPALIVE
+int kf_restore_all(const void* buffer, int size, int* handles, int capacity) {
+    SnapshotSetHeader header;
+    if (!buffer || size < int(sizeof(header)) || capacity < 0) {
+        return 0;  // Invalid arguments
+    }
+    
+    const unsigned char* in = static_cast<const unsigned char*>(buffer);
+    std::memcpy(&header, in, sizeof(header));
+    if (header.magic != kSnapshotSetMagic || header.version != kSnapshotVersion ||
+        header.count > uint32_t(capacity) || (header.count && !handles)) {
+        return 0;  // Not a snapshot set, or too many filters for handles
+    }
+    
+    // All or nothing: a bad record destroys the filters restored before it
+    size_t offset = sizeof(header);
+    for (uint32_t i = 0; i < header.count; i++) {
+        SnapshotRecord record;
+        KalmanFilterBase* filter = nullptr;
+        if (size_t(size) - offset >= sizeof(record)) {
+            std::memcpy(&record, in + offset, sizeof(record));
+            offset += sizeof(record);
+            if (size_t(size) - offset >= record.bytes) {
+                filter = read_snapshot(in + offset, record.bytes);
+                offset += record.bytes;
+            }
+        }
+        
+        int handle = filter ? register_filter(filter) : 0;
+        if (!handle) {
+            for (uint32_t j = 0; j < i; j++) {
+                delete g_filters.remove(handles[2 * j + 1]);
+            }
+            return 0;
+        }
+        handles[2 * i] = record.handle;
+        handles[2 * i + 1] = handle;
+    }
+    return int(header.count);
+}
+
+EMSCRIPTEN_KEEPALIVE
+void kf_destroy(int handle) {
+    delete g_filters.remove(handle);
 }
 
 } // extern "C" 
\ No newline at end of file
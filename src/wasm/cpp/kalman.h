@@ -5,15 +5,33 @@
  * This header defines a C-style API for the Kalman filter that can be
  * easily exposed through WebAssembly. The implementation is tailored for
  * motion data filtering with focus on low latency and minimal allocations.
+ * 
+ * Native builds may call the API from several threads at once. Each call
+ * locks only the filter its handle refers to, so calls on different
+ * handles run in parallel. Calls on the same handle are serialised, and
+ * kf_destroy waits for a call in progress on that handle. Returned
+ * pointers refer to the filter's own buffers, so one handle should still
+ * be driven by one thread at a time.
  */
 
 #ifndef KALMAN_H
 #define KALMAN_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * @brief Motion models accepted by kf_create_motion
+ */
+enum kf_motion_model {
+    KF_MODEL_RANDOM_WALK = 0,           /**< x' = x, same filter as kf_create */
+    KF_MODEL_CONSTANT_VELOCITY = 1,     /**< Position and velocity per axis */
+    KF_MODEL_CONSTANT_ACCELERATION = 2  /**< Position, velocity and acceleration per axis */
+};
+
 /**
  * @brief Create a new Kalman filter instance
  * 
@@ -24,16 +42,537 @@ extern "C" {
  */
 int kf_create(int dimensions, double process_noise, double measurement_noise);
 
+/**
+ * @brief Create a single-precision Kalman filter
+ * 
+ * Same model as kf_create, but state and covariance are stored as 32-bit
+ * floats, halving memory and doubling SIMD lane width. Use kf_update_f32
+ * with the returned handle; the double-precision kf_update and
+ * kf_update_batch reject it.
+ * 
+ * @param dimensions Number of dimensions (state variables)
+ * @param process_noise Process noise covariance
+ * @param measurement_noise Measurement noise covariance
+ * @return Handle to the created filter, or 0 on failure
+ */
+int kf_create_f32(int dimensions, double process_noise, double measurement_noise);
+
+/**
+ * @brief Create a Kalman filter that starts at its steady-state gain
+ * 
+ * Same model as kf_create, but the converged covariance and gain are solved
+ * in closed form up front, so every update is just x += K * (z - x).
+ * Filters created by kf_create reach this mode on their own once the
+ * covariance stops changing.
+ * 
+ * @param dimensions Number of dimensions (state variables)
+ * @param process_noise Process noise covariance (>= 0)
+ * @param measurement_noise Measurement noise covariance (> 0)
+ * @return Handle to the created filter, or 0 on failure
+ */
+int kf_create_steady(int dimensions, double process_noise, double measurement_noise);
+
+/**
+ * @brief Create a Kalman filter that shares its covariance with similar filters
+ * 
+ * With F = H = I and fixed noise the covariance and gain evolve independently
+ * of the measurements, so every filter created through this function with the
+ * same noise parameters reads its gain from one shared trajectory and only
+ * stores its own state vector. The trajectory is kept until the gain
+ * settles, at most 4096 steps (32 KiB per noise pair); a filter outliving
+ * an unsettled one (process_noise 0 or tiny) continues the recursion on its
+ * own scalar covariance. Results match kf_create bit for bit.
+ * 
+ * @param dimensions Number of dimensions (state variables)
+ * @param process_noise Process noise covariance
+ * @param measurement_noise Measurement noise covariance
+ * @return Handle to the created filter, or 0 on failure
+ */
+int kf_create_shared(int dimensions, double process_noise, double measurement_noise);
+
+/**
+ * @brief Create a Kalman filter with a built-in motion model
+ * 
+ * Each of the dimensions measured positions gets its own hidden velocity
+ * (and acceleration) states, which lets the estimate keep up with fast
+ * motion instead of lagging like the random-walk model. Every axis runs a
+ * closed-form 2x2 or 3x3 recursion, so the cost stays O(dimensions).
+ * Updates and kf_update_into use one position per axis; velocities are
+ * per frame interval (see kf_set_frame_interval).
+ * 
+ * @param dimensions Number of measured axes (e.g. 63 for 21 landmarks in 3D)
+ * @param model One of kf_motion_model
+ * @param process_noise Spectral density of the white noise driving the
+ *                      highest modelled derivative
+ * @param measurement_noise Position measurement noise variance
+ * @return Handle to the created filter, or 0 on failure
+ */
+int kf_create_motion(int dimensions, int model, double process_noise, double measurement_noise);
+
+/**
+ * @brief Create a Kalman filter from explicit model matrices
+ * 
+ * The measurement matrix H is the identity. When F, Q and R are all
+ * diagonal the filter runs an O(N) per-channel recursion; otherwise the
+ * dense O(N^3) path is used. Q and R are covariances and must be
+ * symmetric; only their upper triangles are read.
+ * 
+ * @param dimensions Number of dimensions (state variables)
+ * @param transition Row-major dimensions x dimensions state transition matrix (F)
+ * @param process_noise Row-major dimensions x dimensions process noise covariance (Q)
+ * @param measurement_noise Row-major dimensions x dimensions measurement noise covariance (R)
+ * @return Handle to the created filter, or 0 on failure
+ */
+int kf_create_model(int dimensions, const double* transition, const double* process_noise,
+                    const double* measurement_noise);
+
+/**
+ * @brief Create a Kalman filter with a general measurement matrix
+ * 
+ * Measurements relate to the state through z = H * x + v, with H of any
+ * shape and a full (correlated) R, e.g. joint angles derived from
+ * landmark positions. The gain is solved through a Cholesky factorisation
+ * of the innovation covariance, about measurement_dimensions^3 / 6
+ * operations per update, with no explicit inverse and no allocation.
+ * Updates take measurement_dimensions values and return
+ * state_dimensions values. As with kf_create_model, only the upper
+ * triangles of Q and R are read.
+ * 
+ * @param state_dimensions Number of state variables (N)
+ * @param measurement_dimensions Number of measurements per update (M)
+ * @param transition Row-major N x N state transition matrix (F)
+ * @param measurement_matrix Row-major M x N measurement matrix (H)
+ * @param process_noise Row-major N x N process noise covariance (Q)
+ * @param measurement_noise Row-major M x M measurement noise covariance (R),
+ *                          positive definite
+ * @return Handle to the created filter, or 0 on failure
+ */
+int kf_create_general(int state_dimensions, int measurement_dimensions, const double* transition,
+                      const double* measurement_matrix, const double* process_noise,
+                      const double* measurement_noise);
+
+/**
+ * @brief Create a Kalman filter that propagates its covariance in factored form
+ * 
+ * Same model as kf_create_general, but P is carried as U * D * U^T (U unit
+ * upper triangular, D diagonal) and updated with Thornton's time update and
+ * Bierman's sequential measurement update. P stays symmetric and positive
+ * semi-definite by construction, so results stay stable over long runs
+ * where the covariance form loses precision. The gain is never frozen.
+ * kf_update_masked is only supported when R is diagonal.
+ * 
+ * @param state_dimensions Number of state variables (N)
+ * @param measurement_dimensions Number of measurements per update (M)
+ * @param transition Row-major N x N state transition matrix (F)
+ * @param measurement_matrix Row-major M x N measurement matrix (H)
+ * @param process_noise Row-major N x N process noise covariance (Q),
+ *                      positive semi-definite
+ * @param measurement_noise Row-major M x M measurement noise covariance (R),
+ *                          positive definite
+ * @return Handle to the created filter, or 0 on failure
+ */
+int kf_create_ud(int state_dimensions, int measurement_dimensions, const double* transition,
+                 const double* measurement_matrix, const double* process_noise,
+                 const double* measurement_noise);
+
+/**
+ * @brief Create a single-precision factored Kalman filter
+ * 
+ * Same as kf_create_ud, but the filter runs in float: update it with
+ * kf_update_f32, or through its float I/O buffer and kf_update_into. The
+ * factored form is what makes single precision safe for cross-coupled
+ * models. kf_update, kf_update_at and kf_update_masked reject it.
+ * 
+ * @param state_dimensions Number of state variables (N)
+ * @param measurement_dimensions Number of measurements per update (M)
+ * @param transition Row-major N x N state transition matrix (F)
+ * @param measurement_matrix Row-major M x N measurement matrix (H)
+ * @param process_noise Row-major N x N process noise covariance (Q),
+ *                      positive semi-definite
+ * @param measurement_noise Row-major M x M measurement noise covariance (R),
+ *                          positive definite
+ * @return Handle to the created filter, or 0 on failure
+ */
+int kf_create_ud_f32(int state_dimensions, int measurement_dimensions, const double* transition,
+                     const double* measurement_matrix, const double* process_noise,
+                     const double* measurement_noise);
+
 /**
  * @brief Update the filter with new measurements
  * 
  * @param handle Filter handle from kf_create
  * @param measurements Pointer to array of measurements
  * @param count Number of measurements (must match dimensions)
- * @return Pointer to the filter's current state estimate
+ * @return Pointer to the filter's current state estimate, or nullptr if the
+ *         handle is invalid, the count mismatches or the innovation
+ *         covariance is not positive definite
  */
 double* kf_update(int handle, const double* measurements, int count);
 
+/**
+ * @brief Update a single-precision filter with new measurements
+ * 
+ * @param handle Filter handle from kf_create_f32 or kf_create_ud_f32
+ * @param measurements Pointer to array of measurements
+ * @param count Number of measurements (must match dimensions)
+ * @return Pointer to the filter's current state estimate, or nullptr if the
+ *         handle is invalid, the count mismatches or the filter is double precision
+ */
+float* kf_update_f32(int handle, const float* measurements, int count);
+
+/**
+ * @brief Update only the channels that have a valid measurement
+ * 
+ * Channels whose mask bit is clear (e.g. occluded landmarks) only run the
+ * predict step: their estimate follows the model and their uncertainty
+ * grows. Their entries in measurements are ignored and may hold anything,
+ * including NaN. Nothing is reallocated or rebuilt. Shared-gain filters
+ * (kf_create_shared) cannot diverge per channel and reject masked updates.
+ * For kf_create_general filters the bits select measurements rather than
+ * state channels.
+ * 
+ * @param handle Filter handle (double precision)
+ * @param measurements Pointer to array of measurements
+ * @param count Number of measurements (must match dimensions)
+ * @param mask Validity bits, channel i at bit (i % 32) of mask[i / 32];
+ *             nullptr updates every channel
+ * @return Pointer to the filter's current state estimate, or nullptr if the
+ *         handle is invalid, the count mismatches or masking is unsupported
+ */
+double* kf_update_masked(int handle, const double* measurements, int count, const uint32_t* mask);
+
+/**
+ * @brief Fuse several measurement sets of the same subject in one update
+ * 
+ * Each set (e.g. one camera) measures the same channels with noise
+ * R / weight. The sets are combined in information form, which is
+ * additive: per channel the weights are summed and the measurements
+ * averaged by weight, then one update runs with the fused measurement and
+ * noise R / total weight. The result equals applying every set as its own
+ * measurement, but costs one covariance update instead of one per set.
+ * A channel whose weights are all 0 (e.g. occluded in every camera) only
+ * runs the predict step.
+ * 
+ * Dense filters with a correlated R use W^-1/2 * R * W^-1/2, exact when
+ * all channels have the same total weight. Shared-gain, single-precision
+ * and kf_create_ud filters with a correlated R reject weighted updates.
+ * 
+ * @param handle Filter handle (double precision)
+ * @param measurements set_count * count measurements, set-major: channel i
+ *                     of set s is at index s * count + i
+ * @param weights Same layout, the inverse noise scale of every value; 0
+ *                marks a missing value, which may then hold anything
+ *                (including NaN); nullptr weighs everything 1
+ * @param set_count Number of measurement sets
+ * @param count Number of measurements per set (must match dimensions)
+ * @return Pointer to the filter's current state estimate, or nullptr if the
+ *         handle is invalid, the count mismatches or the filter does not
+ *         support weighted updates
+ */
+double* kf_update_multi(int handle, const double* measurements, const double* weights, int set_count,
+                        int count);
+
+/**
+ * @brief Update the filter with measurements taken at a given time
+ * 
+ * The time since the previous timestamped update is converted into filter
+ * steps of kf_set_frame_interval seconds (1/30 s by default), and the
+ * prediction covers that many steps, including fractional and zero steps.
+ * Gaps are capped at 1024 steps, and gaps within 0.001 steps of one frame
+ * interval count as exactly one step, so jittered frame timestamps keep the
+ * frozen steady-state gain. The first timestamped update counts as one
+ * step. Shared-gain filters advance exactly one step per update.
+ * 
+ * Over k whole steps plus a fraction a the transition is
+ * F^k * ((1 - a) * I + a * F). How the process noise follows depends on
+ * the filter: dense kf_create_model filters propagate it exactly, as the
+ * sum of F^i * Q * (F^i)^T over the steps (with a * Q for the fraction),
+ * and motion models use their closed-form noise for the elapsed time.
+ * The per-channel filters (kf_create and friends) and kf_create_ud
+ * filters use Q * steps, which is exact when F = I, as in kf_create, and
+ * an approximation otherwise.
+ * 
+ * @param handle Filter handle (double precision)
+ * @param measurements Pointer to array of measurements
+ * @param count Number of measurements (must match dimensions)
+ * @param timestamp Measurement time in seconds; older than the previous one
+ *                  only with kf_enable_history
+ * @return Pointer to the filter's current state estimate, or nullptr if the
+ *         handle is invalid, the count mismatches, the filter is single
+ *         precision, the timestamp is NaN or infinite or it is older than
+ *         the history reaches
+ */
+double* kf_update_at(int handle, const double* measurements, int count, double timestamp);
+
+/**
+ * @brief Enable fixed-lag smoothing
+ * 
+ * The filter keeps a preallocated window of its last lag + 1 frames so
+ * kf_update_lagged can return smoothed estimates with a fixed delay of
+ * lag frames (e.g. 3 frames = 100 ms at 30 fps). Supported by the
+ * per-channel filters from kf_create, kf_create_steady and diagonal
+ * kf_create_model models.
+ * 
+ * @param handle Filter handle
+ * @param lag Delay in frames, 0 to disable
+ * @return 1 on success, 0 if the handle or lag is invalid or the filter
+ *         does not support fixed-lag smoothing
+ */
+int kf_enable_fixed_lag(int handle, int lag);
+
+/**
+ * @brief Update the filter and get the smoothed estimate from lag frames ago
+ * 
+ * Runs a regular update, then a Rauch-Tung-Striebel backward pass over the
+ * window, so frame t - lag is estimated from every measurement up to frame
+ * t at O(lag * dimensions) cost. Mixing in other kinds of update leaves
+ * gaps in the window.
+ * 
+ * @param handle Filter handle with fixed-lag smoothing enabled
+ * @param measurements Pointer to array of measurements
+ * @param count Number of measurements (must match dimensions)
+ * @return Pointer to the smoothed estimate of frame t - lag, or nullptr
+ *         while the first lag frames fill the window, or on error
+ */
+double* kf_update_lagged(int handle, const double* measurements, int count);
+
+/**
+ * @brief Keep a history of recent timestamped updates for late measurements
+ * 
+ * With a history, kf_update_at also accepts measurements older than the
+ * previous one: the filter rewinds to the newest recorded state not after
+ * the late timestamp, applies it, and re-applies the later recorded
+ * measurements, at most capacity steps. All history storage is allocated
+ * here, so updates stay allocation-free. Only kf_update_at updates are
+ * recorded; other updates made since the rewind point are dropped by a rewind.
+ * 
+ * @param handle Filter handle
+ * @param capacity Number of updates to keep, 0 to disable
+ * @return 1 on success, 0 if the handle or capacity is invalid
+ */
+int kf_enable_history(int handle, int capacity);
+
+/**
+ * @brief Extrapolate the state without updating the filter
+ * 
+ * Applies the transition for dt seconds past the last update, e.g. to place
+ * a landmark at display time between camera frames. Whole frame intervals
+ * apply F exactly; the remainder interpolates linearly to the next step.
+ * The filter itself is not modified.
+ * 
+ * @param handle Filter handle
+ * @param dt Seconds past the last update (0 to 1024 frame intervals)
+ * @return Pointer to dimensions doubles holding the prediction, valid until
+ *         the next call on this handle, or nullptr if the handle or dt is invalid
+ */
+double* kf_predict(int handle, double dt);
+
+/**
+ * @brief Set how many seconds one application of the transition covers
+ * 
+ * @param handle Filter handle
+ * @param seconds Frame interval in seconds (> 0), 1/30 by default
+ * @return 1 on success, 0 if the handle or interval is invalid
+ */
+int kf_set_frame_interval(int handle, double seconds);
+
+/**
+ * @brief Get the filter's persistent measurement/estimate buffer
+ * 
+ * The buffer holds dimensions values in the filter's precision (double, or
+ * float for kf_create_f32 and kf_create_ud_f32 filters), or the larger of
+ * the state and measurement dimensions for kf_create_general and
+ * kf_create_ud filters, and stays at the same address until the filter is
+ * destroyed. Write measurements into it and call kf_update_into
+ * to avoid any per-update allocation or copy.
+ * 
+ * @param handle Filter handle
+ * @return Pointer to the buffer, or nullptr if the handle is invalid
+ */
+void* kf_io_buffer(int handle);
+
+/**
+ * @brief Get the number of values the filter's I/O buffer holds
+ * 
+ * @param handle Filter handle
+ * @return Length of the kf_io_buffer buffer in values, 0 if the handle is
+ *         invalid
+ */
+int kf_io_buffer_size(int handle);
+
+/**
+ * @brief Get the precision of the filter's I/O buffer
+ * 
+ * @param handle Filter handle
+ * @return Bytes per value: 8 for double, 4 for float filters, 0 if the
+ *         handle is invalid
+ */
+int kf_io_buffer_precision(int handle);
+
+/**
+ * @brief Update the filter in place from its I/O buffer
+ * 
+ * Reads the measurements from the buffer returned by kf_io_buffer and
+ * overwrites them with the new state estimate.
+ * 
+ * @param handle Filter handle
+ * @return 1 on success, 0 if the handle is invalid
+ */
+int kf_update_into(int handle);
+
+/**
+ * @brief Update many filters in a single call
+ * 
+ * Measurements and results are filter-major: channel d of the f-th filter
+ * is at index f * dimensions + d, so each filter reads and writes one
+ * contiguous row. Every handle is resolved once per call, and the whole
+ * frame crosses the JS/WASM boundary once instead of once per filter.
+ * 
+ * Each filter still runs its own update, vectorised across its channels;
+ * nothing is vectorised across filters. Every filter keeps its state in
+ * its own block, so a pass across filters has to gather and scatter every
+ * value, which measured slower than the per-filter loop even for
+ * one-channel filters (see bench/batch_check.cpp).
+ * 
+ * @param handles Array of filter_count filter handles
+ * @param filter_count Number of filters to update
+ * @param measurements dimensions * filter_count measurements
+ * @param dimensions Number of channels per filter (must match each filter's
+ *                   state and measurement dimensions)
+ * @param out Receives dimensions * filter_count estimates; rows of invalid
+ *            or single-precision handles are set to NaN
+ * @return Number of filters that were updated
+ */
+int kf_update_batch(const int* handles, int filter_count, const double* measurements,
+                    int dimensions, double* out);
+
+/**
+ * @brief Change the noise levels without resetting the filter
+ * 
+ * State and covariance are kept, and the gain re-converges to the new
+ * noise from there. Supported by the filters with scalar noise parameters:
+ * kf_create, kf_create_f32, kf_create_steady, kf_create_motion and
+ * diagonal kf_create_model models (where it replaces every channel's
+ * noise). Matrix models and shared-gain filters reject it.
+ * 
+ * @param handle Filter handle
+ * @param process_noise New process noise (>= 0)
+ * @param measurement_noise New measurement noise (> 0)
+ * @return 1 on success, 0 if the handle or noise is invalid or the filter
+ *         does not support it
+ */
+int kf_set_noise(int handle, double process_noise, double measurement_noise);
+
+/**
+ * @brief Estimate the noise online from innovation statistics
+ * 
+ * Every single-step update refreshes running moments, over about window
+ * updates, of each channel's one-step innovation y = z - F * z_prev and
+ * re-estimates that channel's noise from them: R = -E[y * y_prev] / F
+ * and Q = E[y^2] - (1 + F^2) * R. These do not depend on the filter's
+ * gain, so a badly tuned filter converges to the right noise. Estimates
+ * are floored at 1/1000 of the values in force when adapting started.
+ * It costs O(1) per channel per update and allocates only here. While
+ * adapting the gain is never frozen; masked, weighted and multi-step
+ * updates are left out of the estimates.
+ * Supported by the per-channel filters (kf_create, kf_create_f32,
+ * kf_create_steady and diagonal kf_create_model models).
+ * 
+ * @param handle Filter handle
+ * @param window Averaging window in updates, 0 to stop adapting and keep
+ *               the current estimates
+ * @return 1 on success, 0 if the handle or window is invalid or the
+ *         filter does not support adaptive noise
+ */
+int kf_enable_adaptive(int handle, int window);
+
+/**
+ * @brief Leave steady-state mode and let the gain re-converge
+ * 
+ * Restores the initial covariance, so the filter becomes responsive again
+ * (e.g. after a tracking loss) and re-detects convergence on its own.
+ * 
+ * @param handle Filter handle from kf_create
+ * @return 1 on success, 0 if the handle is invalid
+ */
+int kf_reset_gain(int handle);
+
+/**
+ * @brief Save a filter's model and state as a binary blob
+ * 
+ * The blob has a versioned fixed-layout header (kind, dimensions, frame
+ * interval and timestamp clock), then the model and then the state with
+ * the covariance in packed form. It is written straight into buffer, with
+ * no intermediate allocation, and kf_restore turns it back into an
+ * identical filter, e.g. in another worker or after a page reload. The
+ * history ring, fixed-lag window and adaptive mode are not included; the
+ * noise estimated so far is. Every filter type is supported.
+ * 
+ * @param handle Filter handle
+ * @param buffer Receives the blob, or null to query its size
+ * @param capacity Bytes available at buffer; nothing is written if the
+ *                 blob does not fit
+ * @return Size of the blob in bytes, 0 if the handle is invalid
+ */
+int kf_snapshot(int handle, void* buffer, int capacity);
+
+/**
+ * @brief Create a filter from a kf_snapshot blob
+ * 
+ * @param buffer Blob from kf_snapshot
+ * @param size Bytes available at buffer
+ * @return New handle, or 0 if the blob is truncated, corrupt or from
+ *         another format version
+ */
+int kf_restore(const void* buffer, int size);
+
+/**
+ * @brief Save every live filter in one blob
+ * 
+ * A set header followed, per filter, by its handle, the size of its
+ * snapshot and the kf_snapshot blob itself.
+ * 
+ * @param buffer Receives the blob, or null to query its size
+ * @param capacity Bytes available at buffer; nothing is written if the
+ *                 blob does not fit
+ * @return Size of the blob in bytes
+ */
+int kf_snapshot_all(void* buffer, int capacity);
+
+/**
+ * @brief Create filters from a kf_snapshot_all blob
+ * 
+ * All or nothing: if any record is invalid, the filters restored before it
+ * are destroyed again.
+ * 
+ * @param buffer Blob from kf_snapshot_all
+ * @param size Bytes available at buffer
+ * @param handles Receives a pair per filter: handles[2 * i] is its handle
+ *                at snapshot time and handles[2 * i + 1] its new handle
+ * @param capacity Number of pairs handles has room for
+ * @return Number of filters restored, 0 on error
+ */
+int kf_restore_all(const void* buffer, int size, int* handles, int capacity);
+
+/**
+ * @brief Smooth a whole recorded sequence offline
+ * 
+ * Runs the kf_create random-walk filter forward over the sequence, then a
+ * Rauch-Tung-Striebel backward pass, so every frame's estimate uses both
+ * past and future measurements. Channels are independent; native builds
+ * split them across threads.
+ * 
+ * @param sequence length frames of dimensions values, frame-major: channel d
+ *                 of frame t is at index t * dimensions + d
+ * @param length Number of frames
+ * @param dimensions Number of channels per frame
+ * @param params {process_noise, measurement_noise}, as for kf_create
+ * @param out Receives length * dimensions smoothed values in the same
+ *            layout; may be the same buffer as sequence
+ * @return 1 on success, 0 on invalid arguments
+ */
+int kf_smooth(const double* sequence, int length, int dimensions, const double* params, double* out);
+
 /**
  * @brief Destroy a Kalman filter instance and free resources
  * 
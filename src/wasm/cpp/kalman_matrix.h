@@ -0,0 +1,698 @@
+/**
+ * @file kalman_matrix.h
+ * @brief Matrix types and lazy expression templates used by the Kalman filter.
+ *
+ * Arithmetic on matrices builds lightweight expression objects instead of
+ * materialising temporaries. Assigning an expression to a matrix evaluates
+ * it element by element in a single loop nest directly into the destination
+ * and never allocates. A product may not contain another product (that would
+ * not compile), so a chain such as F P F^T + Q is written in two steps
+ * through a workspace matrix:
+ *
+ *     temp = F * P;
+ *     P = temp * transpose(F) + Q;
+ *
+ * Dimension mismatches between fixed-size operands are rejected at compile
+ * time; runtime-sized operands are checked with assert().
+ *
+ * Assignments whose shape matches a kernel in kalman_simd.h (a product of
+ * two matrices, optionally with the right-hand side transposed and/or a
+ * matrix added, a sum or difference of two matrices, or a transpose) are
+ * routed to the SIMD kernels when the matrices are large enough.
+ *
+ * Covariances use SymmetricMatrix, which packs the upper triangle, together
+ * with a few dedicated kernels that only compute one half of each
+ * symmetric result, including an in-place Cholesky factorisation.
+ */
+
+#ifndef KALMAN_MATRIX_H
+#define KALMAN_MATRIX_H
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <vector>
+#include "kalman_simd.h"
+
+// Ask the compiler to fully unroll loops whose trip count is a template constant
+#if defined(__clang__)
+#define KF_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__)
+#define KF_UNROLL _Pragma("GCC unroll 64")
+#else
+#define KF_UNROLL
+#endif
+
+// Marker for a dimension only known at runtime
+constexpr int kDynamic = -1;
+
+// Result dimension of two operands that must agree (kDynamic if either is)
+constexpr int common_dim(int a, int b) {
+    return a == kDynamic ? b : a;
+}
+
+constexpr bool dims_compatible(int a, int b) {
+    return a == kDynamic || b == kDynamic || a == b;
+}
+
+// Base class for every matrix expression (CRTP)
+template <typename Derived>
+class MatrixExpr {
+public:
+    const Derived& derived() const { return static_cast<const Derived&>(*this); }
+
+    int rows() const { return derived().rows(); }
+    int cols() const { return derived().cols(); }
+    auto operator()(int row, int col) const { return derived()(row, col); }
+};
+
+template <typename E> struct ExprTraits;
+
+// Leaves (concrete matrices) are captured by reference, expression nodes by value
+template <typename E>
+using ExprRef = typename std::conditional<ExprTraits<E>::kIsLeaf, const E&, const E>::type;
+
+template <typename A, typename B> class ProductExpr;
+
+template <typename E> struct IsProduct : std::false_type {};
+template <typename A, typename B> struct IsProduct<ProductExpr<A, B>> : std::true_type {};
+
+// Element-wise sum or difference
+template <typename A, typename B, bool Subtract>
+class ElementwiseExpr : public MatrixExpr<ElementwiseExpr<A, B, Subtract>> {
+public:
+    static_assert(dims_compatible(ExprTraits<A>::kRows, ExprTraits<B>::kRows) &&
+                  dims_compatible(ExprTraits<A>::kCols, ExprTraits<B>::kCols),
+                  "matrix dimensions do not match");
+
+    ElementwiseExpr(const A& a, const B& b) : a_(a), b_(b) {
+        assert(a.rows() == b.rows() && a.cols() == b.cols());
+    }
+
+    int rows() const { return a_.rows(); }
+    int cols() const { return a_.cols(); }
+
+    auto operator()(int row, int col) const {
+        return Subtract ? a_(row, col) - b_(row, col) : a_(row, col) + b_(row, col);
+    }
+
+    // Element-wise nodes only read (row, col), so only nested products
+    // or transposes can be affected by the destination aliasing an operand
+    bool unsafe_alias(const void* dst) const {
+        return a_.unsafe_alias(dst) || b_.unsafe_alias(dst);
+    }
+
+    bool aliases(const void* dst) const { return a_.aliases(dst) || b_.aliases(dst); }
+
+    const A& lhs() const { return a_; }
+    const B& rhs() const { return b_; }
+
+private:
+    ExprRef<A> a_;
+    ExprRef<B> b_;
+};
+
+// Transposed view
+template <typename A>
+class TransposeExpr : public MatrixExpr<TransposeExpr<A>> {
+public:
+    explicit TransposeExpr(const A& a) : a_(a) {}
+
+    int rows() const { return a_.cols(); }
+    int cols() const { return a_.rows(); }
+
+    auto operator()(int row, int col) const { return a_(col, row); }
+
+    bool unsafe_alias(const void* dst) const {
+        return a_.aliases(dst) || a_.unsafe_alias(dst);
+    }
+
+    bool aliases(const void* dst) const { return a_.aliases(dst); }
+
+    const A& operand() const { return a_; }
+
+private:
+    ExprRef<A> a_;
+};
+
+// Matrix product, evaluated as one dot product per destination element.
+// Nesting a product inside another product would recompute the inner one
+// for every element (O(N^4)), so that is rejected at compile time: assign
+// the inner product to a workspace matrix first.
+template <typename A, typename B>
+class ProductExpr : public MatrixExpr<ProductExpr<A, B>> {
+public:
+    static_assert(dims_compatible(ExprTraits<A>::kCols, ExprTraits<B>::kRows),
+                  "matrix dimensions do not match for multiplication");
+    static_assert(!IsProduct<A>::value && !IsProduct<B>::value,
+                  "nested products must be materialised into a workspace matrix");
+
+    ProductExpr(const A& a, const B& b) : a_(a), b_(b) {
+        assert(a.cols() == b.rows());
+    }
+
+    int rows() const { return a_.rows(); }
+    int cols() const { return b_.cols(); }
+
+    auto operator()(int row, int col) const {
+        static constexpr int kInner = common_dim(ExprTraits<A>::kCols, ExprTraits<B>::kRows);
+        const int inner = kInner == kDynamic ? a_.cols() : kInner;
+        decltype(a_(0, 0) * b_(0, 0)) sum = 0;
+        KF_UNROLL
+        for (int k = 0; k < inner; k++) {
+            sum += a_(row, k) * b_(k, col);
+        }
+        return sum;
+    }
+
+    // Every destination element reads a whole row and column, so writing
+    // into either operand while evaluating would corrupt the result
+    bool unsafe_alias(const void* dst) const {
+        return a_.aliases(dst) || b_.aliases(dst) ||
+               a_.unsafe_alias(dst) || b_.unsafe_alias(dst);
+    }
+
+    bool aliases(const void* dst) const { return a_.aliases(dst) || b_.aliases(dst); }
+
+    const A& lhs() const { return a_; }
+    const B& rhs() const { return b_; }
+
+private:
+    ExprRef<A> a_;
+    ExprRef<B> b_;
+};
+
+// Identity matrix that occupies no storage
+template <int Size, typename T>
+class IdentityExpr : public MatrixExpr<IdentityExpr<Size, T>> {
+public:
+    explicit IdentityExpr(int size) : size_(size) {
+        assert(Size == kDynamic || Size == size);
+    }
+
+    int rows() const { return size_; }
+    int cols() const { return size_; }
+
+    T operator()(int row, int col) const { return row == col ? T(1) : T(0); }
+
+    bool unsafe_alias(const void*) const { return false; }
+    bool aliases(const void*) const { return false; }
+
+private:
+    int size_;
+};
+
+// Runtime-sized matrix with heap storage (allocated once at construction)
+template <typename T>
+class Matrix : public MatrixExpr<Matrix<T>> {
+public:
+    Matrix(int rows, int cols) : rows_(rows), cols_(cols), data_(rows * cols, T(0)) {}
+
+    template <typename E>
+    Matrix& operator=(const MatrixExpr<E>& expr) {
+        assign(*this, expr.derived());
+        return *this;
+    }
+
+    T& operator()(int row, int col) {
+        return data_[row * cols_ + col];
+    }
+
+    T operator()(int row, int col) const {
+        return data_[row * cols_ + col];
+    }
+
+    int rows() const { return rows_; }
+    int cols() const { return cols_; }
+
+    T* data() { return data_.data(); }
+    const T* data() const { return data_.data(); }
+
+    bool unsafe_alias(const void*) const { return false; }
+    bool aliases(const void* dst) const { return dst == this; }
+
+private:
+    int rows_;
+    int cols_;
+    std::vector<T> data_;
+};
+
+// Fixed-size matrix with inline std::array storage (no heap allocation)
+template <int Rows, int Cols, typename T = double>
+class FixedMatrix : public MatrixExpr<FixedMatrix<Rows, Cols, T>> {
+public:
+    FixedMatrix() { data_.fill(T(0)); }
+
+    // Same signature as Matrix so filters can be written once for both
+    FixedMatrix(int rows, int cols) {
+        assert(rows == Rows && cols == Cols);
+        (void)rows;
+        (void)cols;
+        data_.fill(T(0));
+    }
+
+    template <typename E>
+    FixedMatrix& operator=(const MatrixExpr<E>& expr) {
+        assign(*this, expr.derived());
+        return *this;
+    }
+
+    T& operator()(int row, int col) {
+        return data_[row * Cols + col];
+    }
+
+    T operator()(int row, int col) const {
+        return data_[row * Cols + col];
+    }
+
+    static constexpr int rows() { return Rows; }
+    static constexpr int cols() { return Cols; }
+
+    T* data() { return data_.data(); }
+    const T* data() const { return data_.data(); }
+
+    bool unsafe_alias(const void*) const { return false; }
+    bool aliases(const void* dst) const { return dst == this; }
+
+private:
+    std::array<T, Rows * Cols> data_;
+};
+
+// Storage type for a matrix whose dimensions may or may not be known
+template <int Rows, int Cols, typename T>
+using MatrixStorage = typename std::conditional<Rows == kDynamic || Cols == kDynamic,
+                                                Matrix<T>, FixedMatrix<Rows, Cols, T>>::type;
+
+template <typename T>
+struct ExprTraits<Matrix<T>> {
+    static constexpr bool kIsLeaf = true;
+    static constexpr int kRows = kDynamic;
+    static constexpr int kCols = kDynamic;
+};
+
+template <int Rows, int Cols, typename T>
+struct ExprTraits<FixedMatrix<Rows, Cols, T>> {
+    static constexpr bool kIsLeaf = true;
+    static constexpr int kRows = Rows;
+    static constexpr int kCols = Cols;
+};
+
+template <typename A, typename B, bool Subtract>
+struct ExprTraits<ElementwiseExpr<A, B, Subtract>> {
+    static constexpr bool kIsLeaf = false;
+    static constexpr int kRows = common_dim(ExprTraits<A>::kRows, ExprTraits<B>::kRows);
+    static constexpr int kCols = common_dim(ExprTraits<A>::kCols, ExprTraits<B>::kCols);
+};
+
+template <typename A>
+struct ExprTraits<TransposeExpr<A>> {
+    static constexpr bool kIsLeaf = false;
+    static constexpr int kRows = ExprTraits<A>::kCols;
+    static constexpr int kCols = ExprTraits<A>::kRows;
+};
+
+template <typename A, typename B>
+struct ExprTraits<ProductExpr<A, B>> {
+    static constexpr bool kIsLeaf = false;
+    static constexpr int kRows = ExprTraits<A>::kRows;
+    static constexpr int kCols = ExprTraits<B>::kCols;
+};
+
+template <int Size, typename T>
+struct ExprTraits<IdentityExpr<Size, T>> {
+    static constexpr bool kIsLeaf = false;
+    static constexpr int kRows = Size;
+    static constexpr int kCols = Size;
+};
+
+template <typename E>
+struct IsLeaf : std::integral_constant<bool, ExprTraits<E>::kIsLeaf> {};
+
+// Maps an expression shape onto a SIMD kernel. The generic case declines
+// and leaves evaluation to the element loop in assign().
+template <typename E, typename Enable = void>
+struct KernelAssign {
+    template <typename Dst>
+    static bool run(Dst&, const E&) { return false; }
+};
+
+// dst = A * B
+template <typename A, typename B>
+struct KernelAssign<ProductExpr<A, B>,
+                    typename std::enable_if<IsLeaf<A>::value && IsLeaf<B>::value>::type> {
+    template <typename Dst>
+    static bool run(Dst& dst, const ProductExpr<A, B>& e) {
+        matrix_kernels<typename std::remove_pointer<decltype(dst.data())>::type>().gemm(
+            e.lhs().data(), e.rhs().data(), nullptr, dst.data(), dst.rows(), e.lhs().cols(), dst.cols());
+        return true;
+    }
+};
+
+// dst = A * B^T
+template <typename A, typename B>
+struct KernelAssign<ProductExpr<A, TransposeExpr<B>>,
+                    typename std::enable_if<IsLeaf<A>::value && IsLeaf<B>::value>::type> {
+    template <typename Dst>
+    static bool run(Dst& dst, const ProductExpr<A, TransposeExpr<B>>& e) {
+        matrix_kernels<typename std::remove_pointer<decltype(dst.data())>::type>().gemm_nt(
+            e.lhs().data(), e.rhs().operand().data(), nullptr, dst.data(),
+            dst.rows(), e.lhs().cols(), dst.cols());
+        return true;
+    }
+};
+
+// dst = A * B + C
+template <typename A, typename B, typename C>
+struct KernelAssign<ElementwiseExpr<ProductExpr<A, B>, C, false>,
+                    typename std::enable_if<IsLeaf<A>::value && IsLeaf<B>::value &&
+                                            IsLeaf<C>::value>::type> {
+    template <typename Dst>
+    static bool run(Dst& dst, const ElementwiseExpr<ProductExpr<A, B>, C, false>& e) {
+        matrix_kernels<typename std::remove_pointer<decltype(dst.data())>::type>().gemm(
+            e.lhs().lhs().data(), e.lhs().rhs().data(), e.rhs().data(), dst.data(),
+            dst.rows(), e.lhs().lhs().cols(), dst.cols());
+        return true;
+    }
+};
+
+// dst = A * B^T + C
+template <typename A, typename B, typename C>
+struct KernelAssign<ElementwiseExpr<ProductExpr<A, TransposeExpr<B>>, C, false>,
+                    typename std::enable_if<IsLeaf<A>::value && IsLeaf<B>::value &&
+                                            IsLeaf<C>::value>::type> {
+    template <typename Dst>
+    static bool run(Dst& dst, const ElementwiseExpr<ProductExpr<A, TransposeExpr<B>>, C, false>& e) {
+        matrix_kernels<typename std::remove_pointer<decltype(dst.data())>::type>().gemm_nt(
+            e.lhs().lhs().data(), e.lhs().rhs().operand().data(), e.rhs().data(), dst.data(),
+            dst.rows(), e.lhs().lhs().cols(), dst.cols());
+        return true;
+    }
+};
+
+// dst = A + B, dst = A - B
+template <typename A, typename B, bool Subtract>
+struct KernelAssign<ElementwiseExpr<A, B, Subtract>,
+                    typename std::enable_if<IsLeaf<A>::value && IsLeaf<B>::value>::type> {
+    template <typename Dst>
+    static bool run(Dst& dst, const ElementwiseExpr<A, B, Subtract>& e) {
+        const auto& kernels = matrix_kernels<typename std::remove_pointer<decltype(dst.data())>::type>();
+        (Subtract ? kernels.subtract : kernels.add)(
+            e.lhs().data(), e.rhs().data(), dst.data(), dst.rows() * dst.cols());
+        return true;
+    }
+};
+
+// dst = A^T
+template <typename A>
+struct KernelAssign<TransposeExpr<A>, typename std::enable_if<IsLeaf<A>::value>::type> {
+    template <typename Dst>
+    static bool run(Dst& dst, const TransposeExpr<A>& e) {
+        matrix_kernels<typename std::remove_pointer<decltype(dst.data())>::type>().transpose(
+            e.operand().data(), dst.data(), e.operand().rows(), e.operand().cols());
+        return true;
+    }
+};
+
+// Evaluate an expression into a destination of matching size in one pass
+template <typename Dst, typename E>
+inline void assign(Dst& dst, const E& expr) {
+    static_assert(dims_compatible(ExprTraits<Dst>::kRows, ExprTraits<E>::kRows) &&
+                  dims_compatible(ExprTraits<Dst>::kCols, ExprTraits<E>::kCols),
+                  "cannot assign expression to a matrix of different dimensions");
+    assert(dst.rows() == expr.rows() && dst.cols() == expr.cols());
+    assert(!expr.unsafe_alias(&dst));
+
+    // Small fixed-size matrices are better served by the unrolled loop below
+    static constexpr bool kSmallFixed = ExprTraits<Dst>::kRows != kDynamic &&
+                                        ExprTraits<Dst>::kCols != kDynamic &&
+                                        ExprTraits<Dst>::kRows * ExprTraits<Dst>::kCols < kSimdMinElements;
+    if (!kSmallFixed && dst.rows() * dst.cols() >= kSimdMinElements &&
+        KernelAssign<E>::run(dst, expr)) {
+        return;
+    }
+
+    const int rows = dst.rows();
+    const int cols = dst.cols();
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            dst(i, j) = expr(i, j);
+        }
+    }
+}
+
+// Expression builders
+
+template <typename A, typename B>
+inline ElementwiseExpr<A, B, false> operator+(const MatrixExpr<A>& a, const MatrixExpr<B>& b) {
+    return ElementwiseExpr<A, B, false>(a.derived(), b.derived());
+}
+
+template <typename A, typename B>
+inline ElementwiseExpr<A, B, true> operator-(const MatrixExpr<A>& a, const MatrixExpr<B>& b) {
+    return ElementwiseExpr<A, B, true>(a.derived(), b.derived());
+}
+
+template <typename A, typename B>
+inline ProductExpr<A, B> operator*(const MatrixExpr<A>& a, const MatrixExpr<B>& b) {
+    return ProductExpr<A, B>(a.derived(), b.derived());
+}
+
+template <typename A>
+inline TransposeExpr<A> transpose(const MatrixExpr<A>& a) {
+    return TransposeExpr<A>(a.derived());
+}
+
+template <int Size, typename T>
+inline IdentityExpr<Size, T> identity(int size) {
+    return IdentityExpr<Size, T>(size);
+}
+
+// Symmetric matrices in packed storage
+
+// Storage for the n (n + 1) / 2 entries of a packed symmetric matrix
+template <int Size, typename T>
+struct PackedStorage {
+    typedef std::array<T, Size * (Size + 1) / 2> type;
+    static void init(type& data, int) { data.fill(T(0)); }
+};
+
+template <typename T>
+struct PackedStorage<kDynamic, T> {
+    typedef std::vector<T> type;
+    static void init(type& data, int count) { data.assign(count, T(0)); }
+};
+
+// Symmetric matrix that stores only its upper triangle, packed row by row:
+// row i holds entries (i, i) .. (i, n - 1) contiguously. Covariances take
+// about half the memory and bandwidth of a dense Matrix, and symmetry holds
+// by construction instead of drifting with rounding. Not an expression
+// leaf; the kernels below cover the products the filter needs.
+template <int Size, typename T = double>
+class SymmetricMatrix {
+public:
+    explicit SymmetricMatrix(int size) : size_(size) {
+        assert(Size == kDynamic || Size == size);
+        PackedStorage<Size, T>::init(data_, size * (size + 1) / 2);
+    }
+
+    T& operator()(int row, int col) {
+        return row <= col ? row_data(row)[col - row] : row_data(col)[row - col];
+    }
+
+    T operator()(int row, int col) const {
+        return row <= col ? row_data(row)[col - row] : row_data(col)[row - col];
+    }
+
+    int size() const { return Size == kDynamic ? size_ : Size; }
+    int packed_size() const { return size() * (size() + 1) / 2; }
+
+    // Entries (row, row) .. (row, size - 1)
+    T* row_data(int row) { return data_.data() + offset(row); }
+    const T* row_data(int row) const { return data_.data() + offset(row); }
+
+    T* data() { return data_.data(); }
+    const T* data() const { return data_.data(); }
+
+    void set_identity() {
+        std::fill(data_.begin(), data_.end(), T(0));
+        for (int i = 0; i < size(); i++) {
+            row_data(i)[0] = T(1);
+        }
+    }
+
+private:
+    int offset(int row) const { return row * size() - row * (row - 1) / 2; }
+
+    int size_;
+    typename PackedStorage<Size, T>::type data_;
+};
+
+// out = A * P, A is rows x n row-major, P is n x n symmetric. Each packed
+// row k of P is read once per row of A and serves both (k, j) and (j, k).
+template <int Size, typename T>
+inline void symmetric_multiply(const T* a, int rows, const SymmetricMatrix<Size, T>& p, T* out) {
+    const int n = p.size();
+    for (int r = 0; r < rows; r++) {
+        const T* a_row = a + r * n;
+        T* out_row = out + r * n;
+        std::fill(out_row, out_row + n, T(0));
+        for (int k = 0; k < n; k++) {
+            const T* p_row = p.row_data(k) - k;  // p_row[j] = P(k, j) for j >= k
+            T scale = a_row[k];
+            T mirrored = T(0);
+            for (int j = k + 1; j < n; j++) {
+                out_row[j] += scale * p_row[j];
+                mirrored += a_row[j] * p_row[j];
+            }
+            out_row[k] += scale * p_row[k] + mirrored;
+        }
+    }
+}
+
+// out = A * B^T (+ addend), A and B are n x k row-major and the result is
+// known to be symmetric (e.g. F * P * F^T), so only the upper triangle is
+// computed: half the dot products of a dense product. Packed row i is the
+// 1 x (n - i) product of row i of A with rows i.. of B, which is exactly
+// the shape of the gemm_nt kernel.
+template <int Size, typename T>
+inline void symmetric_product_nt(const T* a, const T* b, int k, const SymmetricMatrix<Size, T>* addend,
+                                 SymmetricMatrix<Size, T>& out) {
+    const MatrixKernels<T>& kernels = matrix_kernels<T>();
+    const int n = out.size();
+    for (int i = 0; i < n; i++) {
+        kernels.gemm_nt(a + i * k, b + i * k, addend ? addend->row_data(i) : nullptr,
+                        out.row_data(i), 1, k, n - i);
+    }
+}
+
+// out -= A^T * B, A and B are k x n row-major and A^T * B is symmetric
+// (e.g. K * (P * H^T)^T with both factors stored transposed). Rank-one
+// updates of the upper triangle with contiguous inner loops.
+template <int Size, typename T>
+inline void symmetric_subtract_product_tn(const T* a, const T* b, int k, SymmetricMatrix<Size, T>& out) {
+    const int n = out.size();
+    for (int p = 0; p < k; p++) {
+        const T* a_row = a + p * n;
+        const T* b_row = b + p * n;
+        for (int i = 0; i < n; i++) {
+            T scale = a_row[i];
+            T* out_row = out.row_data(i) - i;
+            for (int j = i; j < n; j++) {
+                out_row[j] -= scale * b_row[j];
+            }
+        }
+    }
+}
+
+// Factor the symmetric positive definite matrix a in place into U^T * U
+// with U upper triangular, which lands exactly in the packed storage.
+// Each pivot row is scaled, then subtracted from the trailing rows as
+// contiguous row updates; about n^3 / 6 multiply-adds in total.
+// Returns false if a is not positive definite.
+template <int Size, typename T>
+inline bool cholesky_factor(SymmetricMatrix<Size, T>& a) {
+    const int n = a.size();
+    for (int j = 0; j < n; j++) {
+        T* row_j = a.row_data(j) - j;  // row_j[c] = a(j, c) for c >= j
+        if (!(row_j[j] > T(0))) {
+            return false;
+        }
+        T pivot = std::sqrt(row_j[j]);
+        T inv_pivot = T(1) / pivot;
+        row_j[j] = pivot;
+        for (int c = j + 1; c < n; c++) {
+            row_j[c] *= inv_pivot;
+        }
+
+        for (int i = j + 1; i < n; i++) {
+            T scale = row_j[i];
+            T* row_i = a.row_data(i) - i;
+            for (int c = i; c < n; c++) {
+                row_i[c] -= scale * row_j[c];
+            }
+        }
+    }
+    return true;
+}
+
+// Solve (U^T * U) * X = B in place, where u holds the factor from
+// cholesky_factor and b is an n x cols row-major right-hand side. Both
+// substitutions update whole rows of B, so the inner loops are contiguous.
+template <int Size, typename T>
+inline void cholesky_solve(const SymmetricMatrix<Size, T>& u, T* b, int cols) {
+    const int n = u.size();
+
+    // U^T * Y = B, pushing each solved row into the rows below it
+    for (int i = 0; i < n; i++) {
+        const T* u_row = u.row_data(i) - i;
+        T* row_i = b + i * cols;
+        T inv_pivot = T(1) / u_row[i];
+        for (int c = 0; c < cols; c++) {
+            row_i[c] *= inv_pivot;
+        }
+        for (int k = i + 1; k < n; k++) {
+            T factor = u_row[k];
+            T* row_k = b + k * cols;
+            for (int c = 0; c < cols; c++) {
+                row_k[c] -= factor * row_i[c];
+            }
+        }
+    }
+
+    // U * X = Y
+    for (int i = n - 1; i >= 0; i--) {
+        const T* u_row = u.row_data(i) - i;
+        T* row_i = b + i * cols;
+        for (int k = i + 1; k < n; k++) {
+            T factor = u_row[k];
+            const T* row_k = b + k * cols;
+            for (int c = 0; c < cols; c++) {
+                row_i[c] -= factor * row_k[c];
+            }
+        }
+        T inv_pivot = T(1) / u_row[i];
+        for (int c = 0; c < cols; c++) {
+            row_i[c] *= inv_pivot;
+        }
+    }
+}
+
+// Factor the symmetric positive semi-definite n x n row-major matrix a
+// into U * D * U^T, U unit upper triangular (row-major, n x n) and D
+// diagonal. Zero pivots get a zero column in U, so a singular a (e.g. a
+// process noise acting on a few states only) is fine. Returns false if a
+// has a negative pivot, i.e. is not positive semi-definite.
+template <typename T>
+inline bool ud_factor(const T* a, int n, T* u, T* d) {
+    std::fill(u, u + n * n, T(0));
+    for (int j = n - 1; j >= 0; j--) {
+        T pivot = a[j * n + j];
+        for (int k = j + 1; k < n; k++) {
+            pivot -= d[k] * u[j * n + k] * u[j * n + k];
+        }
+        // Pivots within rounding of zero are zero
+        T tolerance = std::numeric_limits<T>::epsilon() * T(n) * std::abs(a[j * n + j]);
+        if (pivot < -tolerance) {
+            return false;
+        }
+        if (pivot <= tolerance) {
+            pivot = T(0);
+        }
+        d[j] = pivot;
+        u[j * n + j] = T(1);
+
+        for (int i = 0; i < j; i++) {
+            T sum = a[i * n + j];
+            for (int k = j + 1; k < n; k++) {
+                sum -= d[k] * u[i * n + k] * u[j * n + k];
+            }
+            u[i * n + j] = pivot > T(0) ? sum / pivot : T(0);
+        }
+    }
+    return true;
+}
+
+#endif /* KALMAN_MATRIX_H */
@@ -0,0 +1,206 @@
+/**
+ * @file kalman_pool.h
+ * @brief Size-class block pool that filters and their arrays live in.
+ *
+ * Filters come and go in bursts as hands enter and leave the frame, and a
+ * filter used to be a handful of separate heap blocks. The pool hands out
+ * one block per filter instead, from per-size-class free lists:
+ *   - creating a filter is O(1) once its size class has warmed up
+ *   - a destroyed filter's block goes straight back to its class and is
+ *     reused by the next filter of a similar size, so the WASM heap (which
+ *     can only grow) does not fragment under churn
+ *   - a filter's object and its per-channel arrays share one contiguous
+ *     block, see PoolArray
+ * Classes are spaced at 2^k and 1.5 * 2^k bytes, so at most a third of a
+ * block is slack. Blocks are carved from slabs that are never returned;
+ * requests above kMaxPooledBytes go to the system allocator.
+ */
+
+#ifndef KALMAN_POOL_H
+#define KALMAN_POOL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+#ifndef __EMSCRIPTEN__
+typedef std::mutex RegistryMutex;
+#else
+// WASM builds are single-threaded, so locking compiles to nothing
+struct RegistryMutex {
+    void lock() {}
+    bool try_lock() { return true; }
+    void unlock() {}
+};
+#endif
+
+// Alignment of every block and of every array carved out of one
+constexpr size_t kPoolAlignment = 16;
+
+inline size_t pool_aligned(size_t bytes) {
+    return (bytes + kPoolAlignment - 1) & ~(kPoolAlignment - 1);
+}
+
+class FilterPool {
+public:
+    static void* allocate(size_t bytes) {
+        return instance().allocate_block(bytes);
+    }
+
+    static void release(void* block) {
+        if (block) {
+            instance().release_block(block);
+        }
+    }
+
+private:
+    static const int kMinLog = 6;                        // Smallest class: 64 bytes
+    static const int kMaxLog = 20;
+    static const size_t kMaxPooledBytes = size_t(1) << kMaxLog;
+    static const int kClasses = 2 * (kMaxLog - kMinLog) + 1;
+    static const uint32_t kUnpooled = 0xffffffffu;       // Class of a malloc'd block
+    static const size_t kSlabBytes = size_t(64) << 10;   // Carved into blocks of one class
+
+    // Sits in front of every block and remembers where it goes back to.
+    // A free block's payload holds the next free block of its class.
+    struct alignas(kPoolAlignment) Header {
+        uint32_t size_class;
+    };
+
+    struct alignas(64) SizeClass {
+        SizeClass() : free_head(nullptr) {}
+
+        RegistryMutex mutex;
+        void* free_head;
+    };
+
+    static FilterPool& instance() {
+        static FilterPool pool;
+        return pool;
+    }
+
+    // Smallest class of at least `bytes`: 64, 96, 128, 192, 256, ...
+    static int size_class(size_t bytes) {
+        if (bytes <= (size_t(1) << kMinLog)) {
+            return 0;
+        }
+        int log = kMinLog;
+        while ((size_t(2) << log) < bytes) {
+            log++;
+        }
+        // Now 2^log < bytes <= 2^(log + 1)
+        return 2 * (log - kMinLog) + (bytes <= (size_t(3) << (log - 1)) ? 1 : 2);
+    }
+
+    static size_t class_bytes(int size_class) {
+        if (size_class == 0) {
+            return size_t(1) << kMinLog;
+        }
+        int log = kMinLog + (size_class - 1) / 2;
+        return size_class % 2 ? size_t(3) << (log - 1) : size_t(2) << log;
+    }
+
+    void* allocate_block(size_t bytes) {
+        if (bytes > kMaxPooledBytes) {
+            void* raw = std::aligned_alloc(kPoolAlignment, pool_aligned(sizeof(Header) + bytes));
+            if (!raw) {
+                throw std::bad_alloc();
+            }
+            static_cast<Header*>(raw)->size_class = kUnpooled;
+            return static_cast<Header*>(raw) + 1;
+        }
+
+        int index = size_class(bytes);
+        SizeClass& free_list = classes_[index];
+        std::lock_guard<RegistryMutex> lock(free_list.mutex);
+        if (!free_list.free_head) {
+            refill(index);
+        }
+
+        void* block = free_list.free_head;
+        free_list.free_head = *static_cast<void**>(block);
+        return block;
+    }
+
+    void release_block(void* block) {
+        Header* header = static_cast<Header*>(block) - 1;
+        if (header->size_class == kUnpooled) {
+            std::free(header);
+            return;
+        }
+
+        SizeClass& free_list = classes_[header->size_class];
+        std::lock_guard<RegistryMutex> lock(free_list.mutex);
+        *static_cast<void**>(block) = free_list.free_head;
+        free_list.free_head = block;
+    }
+
+    // Carve a new slab into free blocks of one class; called with the
+    // class locked
+    void refill(int index) {
+        size_t stride = sizeof(Header) + class_bytes(index);
+        size_t count = std::max<size_t>(kSlabBytes / stride, 1);
+        unsigned char* slab = static_cast<unsigned char*>(std::aligned_alloc(kPoolAlignment, stride * count));
+        if (!slab) {
+            throw std::bad_alloc();
+        }
+
+        SizeClass& free_list = classes_[index];
+        for (size_t i = count; i-- > 0;) {
+            Header* header = reinterpret_cast<Header*>(slab + i * stride);
+            header->size_class = uint32_t(index);
+            void* block = header + 1;
+            *static_cast<void**>(block) = free_list.free_head;
+            free_list.free_head = block;
+        }
+    }
+
+    SizeClass classes_[kClasses];
+};
+
+// Fixed-length array in storage that belongs to someone else, normally the
+// tail of the pooled block of the filter that owns it. Offers the part of
+// std::vector's interface the filters use.
+template <typename T>
+class PoolArray {
+public:
+    PoolArray() : data_(nullptr), size_(0) {}
+
+    PoolArray(void* storage, size_t size, T value) : data_(static_cast<T*>(storage)), size_(size) {
+        std::fill(data_, data_ + size_, value);
+    }
+
+    T& operator[](size_t i) { return data_[i]; }
+    const T& operator[](size_t i) const { return data_[i]; }
+
+    T* data() { return data_; }
+    const T* data() const { return data_; }
+    size_t size() const { return size_; }
+
+    T* begin() { return data_; }
+    T* end() { return data_ + size_; }
+    const T* begin() const { return data_; }
+    const T* end() const { return data_ + size_; }
+
+    // Bytes one array of `size` values takes in a block
+    static size_t bytes(size_t size) { return pool_aligned(size * sizeof(T)); }
+
+private:
+    T* data_;
+    size_t size_;
+};
+
+// Tag for allocating a pooled object with `bytes` of array storage behind it
+struct PoolExtra {
+    size_t bytes;
+};
+
+// Start of the storage behind an object allocated with PoolExtra
+inline unsigned char* pool_trailing_storage(void* object, size_t object_size) {
+    return static_cast<unsigned char*>(object) + pool_aligned(object_size);
+}
+
+#endif /* KALMAN_POOL_H */
@@ -0,0 +1,289 @@
+/**
+ * @file kalman_simd.h
+ * @brief SIMD kernels for the dense matrix operations of the Kalman filter.
+ *
+ * Every kernel is written once against GCC/Clang vector extensions with the
+ * lane count as a template parameter, plus a scalar tail. The same source is
+ * instantiated per backend:
+ *   - WASM with -msimd128: 128-bit lanes, chosen at compile time
+ *   - x86-64: SSE2 (baseline) or AVX2, chosen at runtime via cpuid
+ *   - anything else: scalar loops
+ * FMA is deliberately not enabled, so gemm, add, subtract and transpose
+ * give bit-identical results on every backend. gemm_nt does not: its vector
+ * kernels keep one partial sum per lane and add them at the end, a different
+ * summation order from the scalar loop, so results may differ in the last
+ * bits between backends.
+ */
+
+#ifndef KALMAN_SIMD_H
+#define KALMAN_SIMD_H
+
+#include <cstring>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define KF_HAVE_VECTOR_EXTENSIONS 1
+#define KF_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define KF_HAVE_VECTOR_EXTENSIONS 0
+#define KF_ALWAYS_INLINE inline
+#endif
+
+// Runtime dispatch only where SSE2 is guaranteed; 32-bit x86 takes the
+// compile-time __SSE2__ check in select_kernels instead
+#if KF_HAVE_VECTOR_EXTENSIONS && defined(__x86_64__)
+#define KF_SIMD_X86 1
+#else
+#define KF_SIMD_X86 0
+#endif
+
+// Don't bother dispatching to a kernel for tiny matrices; the unrolled
+// scalar expression loop is faster than an indirect call there
+constexpr int kSimdMinElements = 16;
+
+// Function table for one scalar type, selected once per process
+template <typename T>
+struct MatrixKernels {
+    // c = a * b (+ addend), a is m x k, b is k x n, addend may be null
+    void (*gemm)(const T* a, const T* b, const T* addend, T* c, int m, int k, int n);
+    // c = a * b^T (+ addend), a is m x k, b is n x k, addend may be null
+    void (*gemm_nt)(const T* a, const T* b, const T* addend, T* c, int m, int k, int n);
+    // c = a + b and c = a - b over count elements
+    void (*add)(const T* a, const T* b, T* c, int count);
+    void (*subtract)(const T* a, const T* b, T* c, int count);
+    // c = a^T, a is rows x cols
+    void (*transpose)(const T* a, T* c, int rows, int cols);
+    const char* name;
+};
+
+namespace kf_simd {
+
+#if KF_HAVE_VECTOR_EXTENSIONS
+
+// Vector of W lanes of T
+template <typename T, int W>
+struct Lanes {
+    typedef T Vec __attribute__((vector_size(sizeof(T) * W)));
+};
+
+template <typename T, int W>
+KF_ALWAYS_INLINE void gemm_kernel(const T* a, const T* b, const T* addend, T* c, int m, int k, int n) {
+    typedef typename Lanes<T, W>::Vec Vec;
+    for (int i = 0; i < m; i++) {
+        const T* a_row = a + i * k;
+        T* c_row = c + i * n;
+        int j = 0;
+
+        // W output columns at a time; each lane sums over k in order,
+        // exactly like the scalar dot product
+        for (; j + W <= n; j += W) {
+            Vec acc = {};
+            for (int p = 0; p < k; p++) {
+                Vec row;
+                std::memcpy(&row, b + p * n + j, sizeof(row));
+                acc += a_row[p] * row;
+            }
+            if (addend) {
+                Vec extra;
+                std::memcpy(&extra, addend + i * n + j, sizeof(extra));
+                acc += extra;
+            }
+            std::memcpy(c_row + j, &acc, sizeof(acc));
+        }
+
+        for (; j < n; j++) {
+            T sum = T(0);
+            for (int p = 0; p < k; p++) {
+                sum += a_row[p] * b[p * n + j];
+            }
+            c_row[j] = addend ? sum + addend[i * n + j] : sum;
+        }
+    }
+}
+
+template <typename T, int W>
+KF_ALWAYS_INLINE void gemm_nt_kernel(const T* a, const T* b, const T* addend, T* c, int m, int k, int n) {
+    typedef typename Lanes<T, W>::Vec Vec;
+    for (int i = 0; i < m; i++) {
+        const T* a_row = a + i * k;
+        for (int j = 0; j < n; j++) {
+            // Both operands are read along contiguous rows. Each lane sums
+            // every W-th product and the lanes are added at the end, so the
+            // rounding differs from the scalar dot product
+            const T* b_row = b + j * k;
+            Vec acc = {};
+            int p = 0;
+            for (; p + W <= k; p += W) {
+                Vec x, y;
+                std::memcpy(&x, a_row + p, sizeof(x));
+                std::memcpy(&y, b_row + p, sizeof(y));
+                acc += x * y;
+            }
+
+            T sum = T(0);
+            for (int lane = 0; lane < W; lane++) {
+                sum += acc[lane];
+            }
+            for (; p < k; p++) {
+                sum += a_row[p] * b_row[p];
+            }
+            c[i * n + j] = addend ? sum + addend[i * n + j] : sum;
+        }
+    }
+}
+
+template <typename T, int W, bool Subtract>
+KF_ALWAYS_INLINE void elementwise_kernel(const T* a, const T* b, T* c, int count) {
+    typedef typename Lanes<T, W>::Vec Vec;
+    int i = 0;
+    for (; i + W <= count; i += W) {
+        Vec x, y;
+        std::memcpy(&x, a + i, sizeof(x));
+        std::memcpy(&y, b + i, sizeof(y));
+        Vec r = Subtract ? x - y : x + y;
+        std::memcpy(c + i, &r, sizeof(r));
+    }
+    for (; i < count; i++) {
+        c[i] = Subtract ? a[i] - b[i] : a[i] + b[i];
+    }
+}
+
+// Tiled so that both the reads and the writes of a W x W block stay
+// within W cache lines; the compiler turns the inner copies into shuffles
+template <typename T, int W>
+KF_ALWAYS_INLINE void transpose_kernel(const T* a, T* c, int rows, int cols) {
+    for (int i0 = 0; i0 < rows; i0 += W) {
+        int i1 = i0 + W < rows ? i0 + W : rows;
+        for (int j0 = 0; j0 < cols; j0 += W) {
+            int j1 = j0 + W < cols ? j0 + W : cols;
+            for (int i = i0; i < i1; i++) {
+                for (int j = j0; j < j1; j++) {
+                    c[j * rows + i] = a[i * cols + j];
+                }
+            }
+        }
+    }
+}
+
+// Instantiate one backend's table. Attributes select the instruction set
+// the always-inline kernels above get compiled for.
+#define KF_DEFINE_BACKEND(NAME, ATTR, BYTES)                                                      \
+    template <typename T>                                                                         \
+    ATTR void gemm_##NAME(const T* a, const T* b, const T* d, T* c, int m, int k, int n) {        \
+        gemm_kernel<T, BYTES / sizeof(T)>(a, b, d, c, m, k, n);                                   \
+    }                                                                                             \
+    template <typename T>                                                                         \
+    ATTR void gemm_nt_##NAME(const T* a, const T* b, const T* d, T* c, int m, int k, int n) {     \
+        gemm_nt_kernel<T, BYTES / sizeof(T)>(a, b, d, c, m, k, n);                                \
+    }                                                                                             \
+    template <typename T>                                                                         \
+    ATTR void add_##NAME(const T* a, const T* b, T* c, int count) {                               \
+        elementwise_kernel<T, BYTES / sizeof(T), false>(a, b, c, count);                          \
+    }                                                                                             \
+    template <typename T>                                                                         \
+    ATTR void subtract_##NAME(const T* a, const T* b, T* c, int count) {                          \
+        elementwise_kernel<T, BYTES / sizeof(T), true>(a, b, c, count);                           \
+    }                                                                                             \
+    template <typename T>                                                                         \
+    ATTR void transpose_##NAME(const T* a, T* c, int rows, int cols) {                            \
+        transpose_kernel<T, BYTES / sizeof(T)>(a, c, rows, cols);                                 \
+    }                                                                                             \
+    template <typename T>                                                                         \
+    MatrixKernels<T> kernels_##NAME() {                                                           \
+        MatrixKernels<T> table = {gemm_##NAME<T>, gemm_nt_##NAME<T>, add_##NAME<T>,               \
+                                  subtract_##NAME<T>, transpose_##NAME<T>, #NAME};                \
+        return table;                                                                             \
+    }
+
+// 16-byte lanes: SSE2 on x86-64, simd128 on WASM, generic otherwise
+KF_DEFINE_BACKEND(simd128, , 16)
+
+#if KF_SIMD_X86
+KF_DEFINE_BACKEND(avx2, __attribute__((target("avx2"))), 32)
+#endif
+
+#undef KF_DEFINE_BACKEND
+
+#endif  // KF_HAVE_VECTOR_EXTENSIONS
+
+// Plain loops, used when the target has no usable vector unit
+template <typename T>
+void gemm_scalar(const T* a, const T* b, const T* addend, T* c, int m, int k, int n) {
+    for (int i = 0; i < m; i++) {
+        for (int j = 0; j < n; j++) {
+            T sum = T(0);
+            for (int p = 0; p < k; p++) {
+                sum += a[i * k + p] * b[p * n + j];
+            }
+            c[i * n + j] = addend ? sum + addend[i * n + j] : sum;
+        }
+    }
+}
+
+template <typename T>
+void gemm_nt_scalar(const T* a, const T* b, const T* addend, T* c, int m, int k, int n) {
+    for (int i = 0; i < m; i++) {
+        for (int j = 0; j < n; j++) {
+            T sum = T(0);
+            for (int p = 0; p < k; p++) {
+                sum += a[i * k + p] * b[j * k + p];
+            }
+            c[i * n + j] = addend ? sum + addend[i * n + j] : sum;
+        }
+    }
+}
+
+template <typename T>
+void add_scalar(const T* a, const T* b, T* c, int count) {
+    for (int i = 0; i < count; i++) {
+        c[i] = a[i] + b[i];
+    }
+}
+
+template <typename T>
+void subtract_scalar(const T* a, const T* b, T* c, int count) {
+    for (int i = 0; i < count; i++) {
+        c[i] = a[i] - b[i];
+    }
+}
+
+template <typename T>
+void transpose_scalar(const T* a, T* c, int rows, int cols) {
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            c[j * rows + i] = a[i * cols + j];
+        }
+    }
+}
+
+template <typename T>
+MatrixKernels<T> kernels_scalar() {
+    MatrixKernels<T> table = {gemm_scalar<T>, gemm_nt_scalar<T>, add_scalar<T>,
+                              subtract_scalar<T>, transpose_scalar<T>, "scalar"};
+    return table;
+}
+
+template <typename T>
+MatrixKernels<T> select_kernels() {
+#if KF_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return kernels_avx2<T>();
+    }
+    return kernels_simd128<T>();  // SSE2 is part of the x86-64 baseline
+#elif KF_HAVE_VECTOR_EXTENSIONS && (defined(__wasm_simd128__) || defined(__ARM_NEON) || defined(__SSE2__))
+    return kernels_simd128<T>();
+#else
+    return kernels_scalar<T>();
+#endif
+}
+
+}  // namespace kf_simd
+
+// Kernels for the current machine, chosen on first use
+template <typename T>
+const MatrixKernels<T>& matrix_kernels() {
+    static const MatrixKernels<T> kernels = kf_simd::select_kernels<T>();
+    return kernels;
+}
+
+#endif /* KALMAN_SIMD_H */
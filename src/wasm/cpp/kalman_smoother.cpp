@@ -0,0 +1,117 @@
+#include "kalman.h"
+#include <algorithm>
+#include <vector>
+#ifndef __EMSCRIPTEN__
+#include <thread>
+#endif
+#include "emscripten.h"
+
+// Offline Rauch-Tung-Striebel smoothing for the random-walk model of
+// kf_create (F = H = I, scalar Q and R, P starts at I).
+//
+// With that model the variances, and therefore the forward gains
+//   k_t = P_t|t-1 / (P_t|t-1 + r)
+// and the smoother gains
+//   c_t = P_t|t / P_t+1|t
+// are the same for every channel and never depend on the data, so they
+// are computed once per call. Each channel then costs one forward and one
+// backward pass of a single multiply-add per frame.
+
+// Below this many frame x channel values threads cost more than they save
+static const long kMinParallelWork = 1 << 16;
+
+// Frame rows need not start on a cache line, so neighbouring ranges share
+// the line that straddles their boundary in every frame. Ranges of at least
+// 32 doubles (four lines) keep that to a small fraction of each one's writes.
+static const int kMinChannelsPerThread = 32;
+
+// Run body(begin, end) over contiguous ranges covering [0, count). Native
+// builds give each hardware thread one range; WASM runs it inline.
+template <typename Body>
+static void parallel_for(int count, long work, Body body) {
+#ifndef __EMSCRIPTEN__
+    int threads = std::min(int(std::thread::hardware_concurrency()), count / kMinChannelsPerThread);
+    int chunk = (count + std::max(threads, 1) - 1) / std::max(threads, 1);
+    if (threads > 1 && work >= kMinParallelWork && chunk < count) {
+        std::vector<std::thread> workers;
+        for (int begin = chunk; begin < count; begin += chunk) {
+            workers.emplace_back(body, begin, std::min(begin + chunk, count));
+        }
+        body(0, chunk);
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        return;
+    }
+#else
+    (void)work;
+#endif
+    body(0, count);
+}
+
+// Forward gains k and smoother gains c for `length` frames
+static void compute_gains(int length, double process_noise, double measurement_noise,
+                          double* filter_gain, double* smoother_gain) {
+    double variance = 1.0;  // Initial P, as in kf_create
+    for (int t = 0; t < length; t++) {
+        double predicted_variance = variance + process_noise;
+        if (t > 0) {
+            smoother_gain[t - 1] = variance / predicted_variance;
+        }
+        double inv_innovation = 1.0 / (predicted_variance + measurement_noise);
+        filter_gain[t] = predicted_variance * inv_innovation;
+        variance = predicted_variance * measurement_noise * inv_innovation;
+    }
+}
+
+// Smooth channels [begin, end). Frames are processed one at a time across
+// the range, so every pass streams through contiguous memory.
+static void smooth_channels(const double* sequence, int length, int dimensions, int begin, int end,
+                            const double* filter_gain, const double* smoother_gain, double* out) {
+    // Forward pass: x_t = x_t-1 + k_t * (z_t - x_t-1), starting from x = 0
+    for (int d = begin; d < end; d++) {
+        out[d] = filter_gain[0] * sequence[d];
+    }
+    for (int t = 1; t < length; t++) {
+        const double* z = sequence + size_t(t) * dimensions;
+        const double* previous = out + size_t(t - 1) * dimensions;
+        double* x = out + size_t(t) * dimensions;
+        double k = filter_gain[t];
+        for (int d = begin; d < end; d++) {
+            x[d] = previous[d] + k * (z[d] - previous[d]);
+        }
+    }
+    
+    // Backward pass: x_t = x_t + c_t * (x_t+1 - x_t), as F = I makes the
+    // prediction of frame t+1 equal to the filtered frame t
+    for (int t = length - 2; t >= 0; t--) {
+        double* x = out + size_t(t) * dimensions;
+        const double* next = out + size_t(t + 1) * dimensions;
+        double c = smoother_gain[t];
+        for (int d = begin; d < end; d++) {
+            x[d] = x[d] + c * (next[d] - x[d]);
+        }
+    }
+}
+
+extern "C" {
+
+EMSCRIPTEN_KEEPALIVE
+int kf_smooth(const double* sequence, int length, int dimensions, const double* params, double* out) {
+    if (!sequence || !params || !out || length <= 0 || dimensions <= 0) {
+        return 0;  // Invalid arguments
+    }
+    
+    std::vector<double> filter_gain(length);
+    std::vector<double> smoother_gain(length);
+    compute_gains(length, params[0], params[1], filter_gain.data(), smoother_gain.data());
+    
+    parallel_for(dimensions, long(length) * dimensions, [&](int begin, int end) {
+        smooth_channels(sequence, length, dimensions, begin, end, filter_gain.data(),
+                        smoother_gain.data(), out);
+    });
+    
+    return 1;
+}
+
+} // extern "C"
@@ -3,10 +3,76 @@
 
 let modulePromise: Promise<any> | null = null;
 
+// Motion models for createMotion, matching kf_motion_model in kalman.h
+export enum MotionModel {
+  RandomWalk = 0,
+  ConstantVelocity = 1,
+  ConstantAcceleration = 2
+}
+
 // Interface for the Kalman filter
 export interface KalmanFilter {
   create(dimensions: number, processNoise: number, measurementNoise: number): number;
+  // Hidden velocity/acceleration states per axis; update() still takes positions
+  createMotion(dimensions: number, model: MotionModel, processNoise: number, measurementNoise: number): number;
+  // z = H * x + v with any M x N measurement matrix and correlated noise;
+  // matrices are row-major. updateGeneral takes M measurements, returns N states.
+  createGeneral(stateDimensions: number, measurementDimensions: number, transition: number[],
+                measurementMatrix: number[], processNoise: number[], measurementNoise: number[]): number;
+  updateGeneral(handle: number, measurement: number[], stateDimensions: number): number[];
+  // Same model carried as P = U * D * U^T, which stays stable in single
+  // precision. f32 handles are updated through ioView(handle) and
+  // updateInto; double ones through updateGeneral.
+  createUD(stateDimensions: number, measurementDimensions: number, transition: number[],
+           measurementMatrix: number[], processNoise: number[], measurementNoise: number[], f32?: boolean): number;
   update(handle: number, measurement: number[]): number[];
+  // Channels with valid[i] === false only run the predict step (occlusion)
+  updateMasked(handle: number, measurement: number[], valid: boolean[]): number[];
+  // One update from several cameras: sets[s] is camera s's measurement and
+  // weights[s] its per-channel confidence (noise R / weight, 0 = not seen).
+  // Every row must be as long as sets[0]. Pass stateDimensions for
+  // createGeneral/createUD filters whose state is not the measurement size.
+  updateMulti(handle: number, sets: number[][], weights?: number[][], stateDimensions?: number): number[];
+  // Timestamps in seconds; the gap since the previous updateAt sets the
+  // prediction length in units of the frame interval (1/30 s by default)
+  updateAt(handle: number, measurement: number[], timestamp: number): number[];
+  // Extrapolated state dt seconds after the last update; the filter is unchanged
+  predict(handle: number, dt: number, dimensions: number): number[];
+  setFrameInterval(handle: number, seconds: number): boolean;
+  // Lets updateAt accept late measurements up to `capacity` updates back
+  enableHistory(handle: number, capacity: number): boolean;
+  // Fixed-lag smoothing: updateLagged returns the smoothed estimate of the
+  // frame `lag` updates back, or [] while the window fills
+  enableFixedLag(handle: number, lag: number): boolean;
+  updateLagged(handle: number, measurement: number[]): number[];
+  // Changes the noise of a running filter without resetting its state
+  setNoise(handle: number, processNoise: number, measurementNoise: number): boolean;
+  // Online noise estimation over about `window` updates; 0 stops adapting
+  enableAdaptive(handle: number, window: number): boolean;
+  // Single-precision filters: handles from createF32 must use updateF32
+  createF32(dimensions: number, processNoise: number, measurementNoise: number): number;
+  updateF32(handle: number, measurement: number[]): number[];
+  // Zero-copy path: write measurements into ioView(handle), call
+  // updateInto(handle), and read the estimates back from the same view.
+  // The view spans the filter's whole buffer in its own precision, a
+  // Float32Array for createF32 and f32 createUD handles.
+  // Views can be detached by memory growth, so fetch them again per frame.
+  ioView(handle: number): Float64Array | Float32Array | null;
+  updateInto(handle: number): boolean;
+  // measurements/result are filter-major: [filter * dimensions + channel];
+  // rows of invalid handles come back as NaN. Saves the per-filter boundary
+  // crossings; each filter is still updated on its own.
+  updateBatch(handles: number[], measurements: number[], dimensions: number): number[];
+  // Binary snapshot of a filter's model and state, e.g. to move a session to
+  // another worker; restore returns a new handle (0 if the blob is invalid)
+  snapshot(handle: number): Uint8Array | null;
+  restore(blob: Uint8Array): number;
+  // Every live filter at once; restoreAll maps old handles to new ones
+  snapshotAll(): Uint8Array;
+  restoreAll(blob: Uint8Array): Map<number, number>;
+  // Offline forward + RTS smoothing of a recording; frame-major
+  // [frame * dimensions + channel] in and out
+  smooth(sequence: number[], dimensions: number, processNoise: number, measurementNoise: number): number[];
   destroy(handle: number): void;
 }
 
@@ -32,7 +98,33 @@ export async function loadKalmanModule(): Promise<KalmanModule> {
         // Provide a fallback that does nothing for development without Emscripten
         return {
           _kf_create: () => 1,
+          _kf_create_motion: () => 1,
+          _kf_create_general: () => 1,
+          _kf_create_ud: () => 1,
+          _kf_create_ud_f32: () => 1,
           _kf_update: () => [],
+          _kf_update_batch: () => 0,
+          _kf_update_masked: () => 0,
+          _kf_update_multi: () => 0,
+          _kf_update_at: () => 0,
+          _kf_predict: () => 0,
+          _kf_set_frame_interval: () => 0,
+          _kf_enable_history: () => 0,
+          _kf_enable_fixed_lag: () => 0,
+          _kf_update_lagged: () => 0,
+          _kf_set_noise: () => 0,
+          _kf_enable_adaptive: () => 0,
+          _kf_create_f32: () => 1,
+          _kf_update_f32: () => [],
+          _kf_io_buffer: () => 0,
+          _kf_io_buffer_size: () => 0,
+          _kf_io_buffer_precision: () => 0,
+          _kf_update_into: () => 0,
+          _kf_snapshot: () => 0,
+          _kf_restore: () => 0,
+          _kf_snapshot_all: () => 0,
+          _kf_restore_all: () => 0,
+          _kf_smooth: () => 0,
           _kf_destroy: () => {},
           _generate_noisy_sine: () => 0,
           _demo_kalman_filter: () => 0,
@@ -45,6 +137,63 @@ export async function loadKalmanModule(): Promise<KalmanModule> {
   
   const wasmModule = await modulePromise;
   
+  // Views of each filter's persistent I/O buffer. They are created once per
+  // handle and only rebuilt when memory growth replaces the heap buffer.
+  const ioViews = new Map<number, Float64Array | Float32Array>();
+  
+  // Scratch validity mask for updateMasked, grown on demand and never freed
+  let maskPtr = 0;
+  let maskWords = 0;
+  
+  // The filter reports the length and precision of its buffer, so a view
+  // never reaches past it whatever the caller passes in
+  const ioView = (handle: number): Float64Array | Float32Array | null => {
+    const heap: ArrayBuffer = wasmModule.HEAPU8.buffer;
+    let view = ioViews.get(handle);
+    if (!view || view.buffer !== heap) {
+      const ptr = wasmModule._kf_io_buffer(handle);
+      if (!ptr) {
+        ioViews.delete(handle);
+        return null;
+      }
+      const length = wasmModule._kf_io_buffer_size(handle);
+      view = wasmModule._kf_io_buffer_precision(handle) === 4
+        ? new Float32Array(heap, ptr, length)
+        : new Float64Array(heap, ptr, length);
+      ioViews.set(handle, view);
+    }
+    return view;
+  };
+  
+  // The handle's I/O view if it is in the requested precision and takes
+  // `length` values (exactly `length` for updateInto, which reads the whole
+  // buffer), otherwise null
+  const measurementView = (handle: number, length: number, f32: boolean,
+                           exact: boolean): Float64Array | Float32Array | null => {
+    const view = ioView(handle);
+    if (!view || (view instanceof Float32Array) !== f32 ||
+        (exact ? length !== view.length : length > view.length)) {
+      return null;
+    }
+    return view;
+  };
+  
+  // Copy F, H, Q and R into one scratch block for a creator; the filter
+  // keeps its own copies, so the block is freed straight away
+  const createFromModel = (create: (...args: number[]) => number, n: number, m: number, transition: number[],
+                           measurementMatrix: number[], processNoise: number[], measurementNoise: number[]): number => {
+    const ptr = wasmModule._malloc((2 * n * n + m * n + m * m) * 8);
+    const matrices = new Float64Array(wasmModule.HEAPF64.buffer, ptr, 2 * n * n + m * n + m * m);
+    matrices.set(transition, 0);
+    matrices.set(measurementMatrix, n * n);
+    matrices.set(processNoise, n * n + m * n);
+    matrices.set(measurementNoise, 2 * n * n + m * n);
+    
+    const handle = create(n, m, ptr, ptr + n * n * 8, ptr + (n * n + m * n) * 8, ptr + (2 * n * n + m * n) * 8);
+    wasmModule._free(ptr);
+    return handle;
+  };
+  
   // Wrap the raw WASM functions in a nicer TypeScript interface
   return {
     // Kalman filter functions
@@ -52,27 +201,289 @@ export async function loadKalmanModule(): Promise<KalmanModule> {
       return wasmModule._kf_create(dimensions, processNoise, measurementNoise);
     },
     
+    createMotion: (dimensions: number, model: MotionModel, processNoise: number, measurementNoise: number): number => {
+      return wasmModule._kf_create_motion(dimensions, model, processNoise, measurementNoise);
+    },
+    
+    createGeneral: (stateDimensions: number, measurementDimensions: number, transition: number[],
+                    measurementMatrix: number[], processNoise: number[], measurementNoise: number[]): number => {
+      return createFromModel(wasmModule._kf_create_general, stateDimensions, measurementDimensions,
+                             transition, measurementMatrix, processNoise, measurementNoise);
+    },
+    
+    createUD: (stateDimensions: number, measurementDimensions: number, transition: number[],
+               measurementMatrix: number[], processNoise: number[], measurementNoise: number[],
+               f32: boolean = false): number => {
+      return createFromModel(f32 ? wasmModule._kf_create_ud_f32 : wasmModule._kf_create_ud,
+                             stateDimensions, measurementDimensions,
+                             transition, measurementMatrix, processNoise, measurementNoise);
+    },
+    
+    updateGeneral: (handle: number, measurement: number[], stateDimensions: number): number[] => {
+      // The I/O buffer fits both the measurements and the state
+      const view = measurementView(handle, Math.max(measurement.length, stateDimensions), false, false);
+      if (!view) {
+        return [];
+      }
+      
+      view.set(measurement);
+      if (wasmModule._kf_update_into(handle) !== 1) {
+        return [];
+      }
+      return Array.from(view.subarray(0, stateDimensions));
+    },
+    
     update: (handle: number, measurement: number[]): number[] => {
-      // In a real implementation, this would convert the array to WASM memory
-      // For example:
-      const heapPtr = wasmModule._malloc(measurement.length * 8);
-      const dataView = new Float64Array(wasmModule.HEAPF64.buffer, heapPtr, measurement.length);
-      dataView.set(measurement);
+      // Measurements go straight into the filter's own buffer, no malloc/free
+      const view = measurementView(handle, measurement.length, false, true);
+      if (!view) {
+        return [];
+      }
       
-      const resultPtr = wasmModule._kf_update(handle, heapPtr, measurement.length);
+      view.set(measurement);
+      if (wasmModule._kf_update_into(handle) !== 1) {
+        return [];
+      }
+      return Array.from(view);
+    },
+    
+    updateMasked: (handle: number, measurement: number[], valid: boolean[]): number[] => {
+      const view = measurementView(handle, measurement.length, false, false);
+      if (!view) {
+        return [];
+      }
       
-      // Copy the result
-      const result = Array.from(new Float64Array(
-        wasmModule.HEAPF64.buffer, 
-        resultPtr, 
-        measurement.length
-      ));
+      const words = Math.ceil(measurement.length / 32);
+      if (words > maskWords) {
+        if (maskPtr) {
+          wasmModule._free(maskPtr);
+        }
+        maskPtr = wasmModule._malloc(words * 4);
+        maskWords = words;
+      }
+      const mask = new Uint32Array(wasmModule.HEAPU32.buffer, maskPtr, words);
+      mask.fill(0);
+      for (let i = 0; i < measurement.length; i++) {
+        if (valid[i]) {
+          mask[i >> 5] |= 1 << (i & 31);
+        }
+      }
+      
+      view.set(measurement);
+      const resultPtr = wasmModule._kf_update_masked(handle, view.byteOffset, measurement.length, maskPtr);
+      if (!resultPtr) {
+        return [];
+      }
+      return Array.from(new Float64Array(wasmModule.HEAPF64.buffer, resultPtr, measurement.length));
+    },
+    
+    updateMulti: (handle: number, sets: number[][], weights?: number[][], stateDimensions?: number): number[] => {
+      if (sets.length === 0) {
+        return [];
+      }
+      
+      // Ragged rows would overrun a row of the heap block or leave part of
+      // it uninitialised, so they are rejected before anything is allocated
+      const count = sets[0].length;
+      if (sets.some(set => set.length !== count) ||
+          (weights && (weights.length !== sets.length || weights.some(row => row.length !== count)))) {
+        return [];
+      }
+      
+      const total = sets.length * count;
+      const measurementsPtr = wasmModule._malloc(total * 8);
+      const weightsPtr = weights ? wasmModule._malloc(total * 8) : 0;
+      for (let s = 0; s < sets.length; s++) {
+        new Float64Array(wasmModule.HEAPF64.buffer, measurementsPtr + s * count * 8, count).set(sets[s]);
+        if (weights) {
+          new Float64Array(wasmModule.HEAPF64.buffer, weightsPtr + s * count * 8, count).set(weights[s]);
+        }
+      }
+      
+      const resultPtr = wasmModule._kf_update_multi(handle, measurementsPtr, weightsPtr, sets.length, count);
+      const result = resultPtr
+        ? Array.from(new Float64Array(wasmModule.HEAPF64.buffer, resultPtr, stateDimensions ?? count))
+        : [];
+      
+      if (weightsPtr) {
+        wasmModule._free(weightsPtr);
+      }
+      wasmModule._free(measurementsPtr);
+      return result;
+    },
+    
+    updateAt: (handle: number, measurement: number[], timestamp: number): number[] => {
+      const view = measurementView(handle, measurement.length, false, false);
+      if (!view) {
+        return [];
+      }
+      
+      view.set(measurement);
+      const resultPtr = wasmModule._kf_update_at(handle, view.byteOffset, measurement.length, timestamp);
+      if (!resultPtr) {
+        return [];
+      }
+      return Array.from(new Float64Array(wasmModule.HEAPF64.buffer, resultPtr, measurement.length));
+    },
+    
+    predict: (handle: number, dt: number, dimensions: number): number[] => {
+      const resultPtr = wasmModule._kf_predict(handle, dt);
+      if (!resultPtr) {
+        return [];
+      }
+      return Array.from(new Float64Array(wasmModule.HEAPF64.buffer, resultPtr, dimensions));
+    },
+    
+    setFrameInterval: (handle: number, seconds: number): boolean => {
+      return wasmModule._kf_set_frame_interval(handle, seconds) === 1;
+    },
+    
+    enableHistory: (handle: number, capacity: number): boolean => {
+      return wasmModule._kf_enable_history(handle, capacity) === 1;
+    },
+    
+    enableFixedLag: (handle: number, lag: number): boolean => {
+      return wasmModule._kf_enable_fixed_lag(handle, lag) === 1;
+    },
+    
+    setNoise: (handle: number, processNoise: number, measurementNoise: number): boolean => {
+      return wasmModule._kf_set_noise(handle, processNoise, measurementNoise) === 1;
+    },
+    
+    enableAdaptive: (handle: number, window: number): boolean => {
+      return wasmModule._kf_enable_adaptive(handle, window) === 1;
+    },
+    
+    updateLagged: (handle: number, measurement: number[]): number[] => {
+      const view = measurementView(handle, measurement.length, false, false);
+      if (!view) {
+        return [];
+      }
+      
+      view.set(measurement);
+      const resultPtr = wasmModule._kf_update_lagged(handle, view.byteOffset, measurement.length);
+      if (!resultPtr) {
+        return [];
+      }
+      return Array.from(new Float64Array(wasmModule.HEAPF64.buffer, resultPtr, measurement.length));
+    },
+    
+    createF32: (dimensions: number, processNoise: number, measurementNoise: number): number => {
+      return wasmModule._kf_create_f32(dimensions, processNoise, measurementNoise);
+    },
+    
+    updateF32: (handle: number, measurement: number[]): number[] => {
+      const view = measurementView(handle, measurement.length, true, true);
+      if (!view) {
+        return [];
+      }
+      
+      view.set(measurement);
+      if (wasmModule._kf_update_into(handle) !== 1) {
+        return [];
+      }
+      return Array.from(view);
+    },
+    
+    ioView: (handle: number): Float64Array | Float32Array | null => {
+      return ioView(handle);
+    },
+    
+    updateInto: (handle: number): boolean => {
+      return wasmModule._kf_update_into(handle) === 1;
+    },
+    
+    updateBatch: (handles: number[], measurements: number[], dimensions: number): number[] => {
+      // One boundary crossing for the whole frame instead of one per filter
+      const count = handles.length * dimensions;
+      const handlesPtr = wasmModule._malloc(handles.length * 4);
+      const measurementsPtr = wasmModule._malloc(count * 8);
+      const outPtr = wasmModule._malloc(count * 8);
+      new Int32Array(wasmModule.HEAP32.buffer, handlesPtr, handles.length).set(handles);
+      new Float64Array(wasmModule.HEAPF64.buffer, measurementsPtr, count).set(measurements);
+      
+      wasmModule._kf_update_batch(handlesPtr, handles.length, measurementsPtr, dimensions, outPtr);
+      
+      const result = Array.from(new Float64Array(wasmModule.HEAPF64.buffer, outPtr, count));
+      
+      wasmModule._free(outPtr);
+      wasmModule._free(measurementsPtr);
+      wasmModule._free(handlesPtr);
+      return result;
+    },
+    
+    snapshot: (handle: number): Uint8Array | null => {
+      // Query the size, then write straight into a heap buffer of that size
+      const size = wasmModule._kf_snapshot(handle, 0, 0);
+      if (!size) {
+        return null;
+      }
+      const bufferPtr = wasmModule._malloc(size);
+      wasmModule._kf_snapshot(handle, bufferPtr, size);
+      const blob = wasmModule.HEAPU8.slice(bufferPtr, bufferPtr + size);
+      wasmModule._free(bufferPtr);
+      return blob;
+    },
+    
+    restore: (blob: Uint8Array): number => {
+      const bufferPtr = wasmModule._malloc(blob.length);
+      wasmModule.HEAPU8.set(blob, bufferPtr);
+      const handle = wasmModule._kf_restore(bufferPtr, blob.length);
+      wasmModule._free(bufferPtr);
+      return handle;
+    },
+    
+    snapshotAll: (): Uint8Array => {
+      const size = wasmModule._kf_snapshot_all(0, 0);
+      const bufferPtr = wasmModule._malloc(size);
+      wasmModule._kf_snapshot_all(bufferPtr, size);
+      const blob = wasmModule.HEAPU8.slice(bufferPtr, bufferPtr + size);
+      wasmModule._free(bufferPtr);
+      return blob;
+    },
+    
+    restoreAll: (blob: Uint8Array): Map<number, number> => {
+      const handles = new Map<number, number>();
+      if (blob.length < 16) {
+        return handles;
+      }
+      // The filter count is the third word of the set header; a record
+      // takes more than 56 bytes, which bounds it for corrupt blobs
+      const header = new DataView(blob.buffer, blob.byteOffset, blob.length);
+      const count = Math.min(header.getUint32(8, true), Math.floor(blob.length / 56));
+      const bufferPtr = wasmModule._malloc(blob.length);
+      const handlesPtr = wasmModule._malloc(Math.max(count, 1) * 2 * 4);
+      wasmModule.HEAPU8.set(blob, bufferPtr);
+      
+      const restored = wasmModule._kf_restore_all(bufferPtr, blob.length, handlesPtr, count);
+      const pairs = new Int32Array(wasmModule.HEAP32.buffer, handlesPtr, restored * 2);
+      for (let i = 0; i < restored; i++) {
+        handles.set(pairs[2 * i], pairs[2 * i + 1]);
+      }
+      
+      wasmModule._free(handlesPtr);
+      wasmModule._free(bufferPtr);
+      return handles;
+    },
+    
+    smooth: (sequence: number[], dimensions: number, processNoise: number, measurementNoise: number): number[] => {
+      // Smoothed in place in a single buffer; this runs once per recording
+      const dataPtr = wasmModule._malloc(sequence.length * 8);
+      const paramsPtr = wasmModule._malloc(2 * 8);
+      new Float64Array(wasmModule.HEAPF64.buffer, dataPtr, sequence.length).set(sequence);
+      new Float64Array(wasmModule.HEAPF64.buffer, paramsPtr, 2).set([processNoise, measurementNoise]);
+      
+      const length = Math.floor(sequence.length / dimensions);
+      const ok = wasmModule._kf_smooth(dataPtr, length, dimensions, paramsPtr, dataPtr);
+      const result = ok ? Array.from(new Float64Array(wasmModule.HEAPF64.buffer, dataPtr, length * dimensions)) : [];
       
-      wasmModule._free(heapPtr);
+      wasmModule._free(paramsPtr);
+      wasmModule._free(dataPtr);
       return result;
     },
     
     destroy: (handle: number): void => {
+      ioViews.delete(handle);
       wasmModule._kf_destroy(handle);
     },
     
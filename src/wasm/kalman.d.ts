@@ -4,7 +4,37 @@ export type Handle = number;
 declare module './kalman' {
   export function createKalmanModule(): Promise<{
     _kf_create: (dimensions: number, processNoise: number, measurementNoise: number) => number;
+    _kf_create_f32: (dimensions: number, processNoise: number, measurementNoise: number) => number;
+    _kf_create_steady: (dimensions: number, processNoise: number, measurementNoise: number) => number;
+    _kf_create_shared: (dimensions: number, processNoise: number, measurementNoise: number) => number;
+    _kf_create_motion: (dimensions: number, model: number, processNoise: number, measurementNoise: number) => number;
+    _kf_create_model: (dimensions: number, transitionPtr: number, processNoisePtr: number, measurementNoisePtr: number) => number;
+    _kf_create_general: (stateDimensions: number, measurementDimensions: number, transitionPtr: number, measurementMatrixPtr: number, processNoisePtr: number, measurementNoisePtr: number) => number;
+    _kf_create_ud: (stateDimensions: number, measurementDimensions: number, transitionPtr: number, measurementMatrixPtr: number, processNoisePtr: number, measurementNoisePtr: number) => number;
+    _kf_create_ud_f32: (stateDimensions: number, measurementDimensions: number, transitionPtr: number, measurementMatrixPtr: number, processNoisePtr: number, measurementNoisePtr: number) => number;
     _kf_update: (handle: number, measurementsPtr: number, count: number) => number;
+    _kf_update_f32: (handle: number, measurementsPtr: number, count: number) => number;
+    _kf_update_masked: (handle: number, measurementsPtr: number, count: number, maskPtr: number) => number;
+    _kf_update_multi: (handle: number, measurementsPtr: number, weightsPtr: number, setCount: number, count: number) => number;
+    _kf_update_at: (handle: number, measurementsPtr: number, count: number, timestamp: number) => number;
+    _kf_predict: (handle: number, dt: number) => number;
+    _kf_set_frame_interval: (handle: number, seconds: number) => number;
+    _kf_enable_history: (handle: number, capacity: number) => number;
+    _kf_enable_fixed_lag: (handle: number, lag: number) => number;
+    _kf_update_lagged: (handle: number, measurementsPtr: number, count: number) => number;
+    _kf_io_buffer: (handle: number) => number;
+    _kf_io_buffer_size: (handle: number) => number;
+    _kf_io_buffer_precision: (handle: number) => number;
+    _kf_update_into: (handle: number) => number;
+    _kf_update_batch: (handlesPtr: number, filterCount: number, measurementsPtr: number, dimensions: number, outPtr: number) => number;
+    _kf_set_noise: (handle: number, processNoise: number, measurementNoise: number) => number;
+    _kf_enable_adaptive: (handle: number, window: number) => number;
+    _kf_reset_gain: (handle: number) => number;
+    _kf_snapshot: (handle: number, bufferPtr: number, capacity: number) => number;
+    _kf_restore: (bufferPtr: number, size: number) => number;
+    _kf_snapshot_all: (bufferPtr: number, capacity: number) => number;
+    _kf_restore_all: (bufferPtr: number, size: number, handlesPtr: number, capacity: number) => number;
+    _kf_smooth: (sequencePtr: number, length: number, dimensions: number, paramsPtr: number, outPtr: number) => number;
     _kf_destroy: (handle: number) => void;
     
     _generate_noisy_sine: (count: number, frequency: number, amplitude: number, noiseLevel: number) => number;